@@ -0,0 +1,106 @@
+// Counts heap allocations made while parsing a document with Json::Load and
+// while tearing it down. Reads the file given as the first argument, or
+// parses a generated base_requests document (5000 stops, 800 buses).
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+
+#include "../json.h"
+
+namespace {
+
+  size_t allocations = 0;
+  size_t frees = 0;
+
+  void* Allocate(std::size_t size) {
+    ++allocations;
+    if (void* ptr = std::malloc(size ? size : 1))
+      return ptr;
+    throw std::bad_alloc();
+  }
+
+  void* AllocateAligned(std::size_t size, std::align_val_t align) {
+    ++allocations;
+    size_t alignment = static_cast<size_t>(align);
+    if (void* ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+      return ptr;
+    throw std::bad_alloc();
+  }
+
+  void Free(void* ptr) {
+    if (ptr) {
+      ++frees;
+      std::free(ptr);
+    }
+  }
+
+  std::string GenerateInput(size_t stopCount, size_t busCount) {
+    std::ostringstream out;
+    out << "{\"base_requests\": [";
+    for (size_t i = 0; i < stopCount; i++) {
+      out << (i ? ", " : "") << "{\"type\": \"Stop\", \"name\": \"Остановка " << i << "\", "
+          << "\"latitude\": " << 43.5 + double(i % 997) / 5000.0 << ", "
+          << "\"longitude\": " << 39.6 + double(i % 991) / 3000.0 << ", "
+          << "\"road_distances\": {\"Остановка " << (i + 1) % stopCount << "\": " << 300 + i % 4700
+          << ", \"Остановка " << (i + 7) % stopCount << "\": " << 500 + i % 3100 << "}}";
+    }
+    for (size_t i = 0; i < busCount; i++) {
+      out << ", {\"type\": \"Bus\", \"name\": \"" << i << "к\", \"stops\": [";
+      for (size_t j = 0; j < 8; j++)
+        out << (j ? ", " : "") << "\"Остановка " << (i * 13 + j) % stopCount << "\"";
+      out << "], \"is_roundtrip\": " << (i % 3 ? "false" : "true") << "}";
+    }
+    out << "]}";
+    return out.str();
+  }
+
+}
+
+void* operator new(std::size_t size) { return Allocate(size); }
+void* operator new[](std::size_t size) { return Allocate(size); }
+void* operator new(std::size_t size, std::align_val_t align) { return AllocateAligned(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return AllocateAligned(size, align); }
+void operator delete(void* ptr) noexcept { Free(ptr); }
+void operator delete[](void* ptr) noexcept { Free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { Free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { Free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { Free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { Free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { Free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { Free(ptr); }
+
+int main(int argc, char* argv[]) {
+  std::string text;
+  if (argc > 1) {
+    std::ifstream file(argv[1]);
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    text = buffer.str();
+  } else {
+    text = GenerateInput(5000, 800);
+  }
+
+  std::istringstream input(text);
+  size_t parseAllocations, teardownFrees;
+  {
+    size_t allocationsBefore = allocations;
+    auto document = Json::Load(input);
+    parseAllocations = allocations - allocationsBefore;
+
+    size_t freesBefore = frees;
+    {
+      auto doomed = std::move(document);
+    }
+    teardownFrees = frees - freesBefore;
+  }
+
+  std::cout << text.size() << " bytes parsed: "
+            << parseAllocations << " allocations while parsing, "
+            << teardownFrees << " frees on teardown\n";
+
+  return 0;
+}
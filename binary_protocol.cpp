@@ -0,0 +1,143 @@
+#include <stdexcept>
+#include <cstring>
+
+#include "binary_protocol.h"
+
+using namespace std;
+
+namespace Binary {
+
+namespace {
+
+static const size_t FRAME_HEADER_SIZE = sizeof(uint32_t);
+// Type and request id, kept from frames too large to read.
+static const size_t MESSAGE_HEADER_SIZE = sizeof(uint8_t) + sizeof(uint32_t);
+
+uint32_t DecodeU32(const char* data)
+{
+    uint32_t val = 0;
+    for(size_t i = 0; i < sizeof(val); i++)
+        val |= uint32_t(uint8_t(data[i])) << (8 * i);
+    return val;
+}
+
+void EncodeU32(char* data, uint32_t val)
+{
+    for(size_t i = 0; i < sizeof(val); i++)
+        data[i] = char(val >> (8 * i));
+}
+
+}
+
+Reader::Reader(string_view data) :
+    data_(data)
+{}
+
+string_view Reader::Take(size_t size)
+{
+    if(data_.size() - pos_ < size)
+        throw DecodeError("Binary::Reader: truncated message");
+
+    auto val = data_.substr(pos_, size);
+    pos_ += size;
+    return val;
+}
+
+uint8_t Reader::U8()
+{
+    return uint8_t(Take(1)[0]);
+}
+
+uint32_t Reader::U32()
+{
+    return DecodeU32(Take(sizeof(uint32_t)).data());
+}
+
+double Reader::F64()
+{
+    auto bytes = Take(sizeof(uint64_t));
+    uint64_t bits = 0;
+    for(size_t i = 0; i < sizeof(bits); i++)
+        bits |= uint64_t(uint8_t(bytes[i])) << (8 * i);
+
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+string_view Reader::String()
+{
+    return Take(U32());
+}
+
+Writer& Writer::Begin(MessageType type, uint32_t requestId)
+{
+    buffer_.assign(FRAME_HEADER_SIZE, '\0');
+    return U8(uint8_t(type)).U32(requestId);
+}
+
+Writer& Writer::U8(uint8_t val)
+{
+    buffer_.push_back(char(val));
+    return *this;
+}
+
+Writer& Writer::U32(uint32_t val)
+{
+    char bytes[sizeof(val)];
+    EncodeU32(bytes, val);
+    buffer_.append(bytes, sizeof(bytes));
+    return *this;
+}
+
+Writer& Writer::F64(double val)
+{
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    for(size_t i = 0; i < sizeof(bits); i++)
+        buffer_.push_back(char(bits >> (8 * i)));
+    return *this;
+}
+
+Writer& Writer::String(string_view val)
+{
+    U32(uint32_t(val.size()));
+    buffer_.append(val);
+    return *this;
+}
+
+void Writer::Flush(ostream& stream)
+{
+    EncodeU32(buffer_.data(), uint32_t(buffer_.size() - FRAME_HEADER_SIZE));
+    stream.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+Frame ReadFrame(istream& stream, string& payload)
+{
+    char header[FRAME_HEADER_SIZE];
+    if(!stream.read(header, sizeof(header)))
+    {
+        if(stream.gcount() == 0)
+            return Frame::End;
+        throw out_of_range("Binary::ReadFrame: truncated frame header");
+    }
+
+    uint32_t size = DecodeU32(header);
+    bool tooLarge = size > MAX_FRAME_SIZE;
+
+    payload.resize(tooLarge ? MESSAGE_HEADER_SIZE : size);
+    if(!stream.read(payload.data(), payload.size()))
+        throw out_of_range("Binary::ReadFrame: truncated frame");
+
+    if(!tooLarge)
+        return Frame::Complete;
+
+    size_t rest = size - payload.size();
+    if(!stream.ignore(streamsize(rest)) || size_t(stream.gcount()) != rest)
+        throw out_of_range("Binary::ReadFrame: truncated frame");
+
+    return Frame::TooLarge;
+}
+
+}
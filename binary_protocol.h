@@ -0,0 +1,105 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <string_view>
+#include <stdexcept>
+#include <iostream>
+#include <cstdint>
+#include <string>
+
+// Length-prefixed binary alternative to the JSON stat_requests/responses.
+//
+// Every message is a frame: u32 payload size followed by the payload. All
+// integers are little-endian, doubles are IEEE 754 binary64 and strings are
+// u32 size + bytes. A payload starts with u8 type and u32 request id:
+//
+//   Names   request: -                    response: u32 n, n * string (stops)
+//                                                   u32 m, m * string (buses)
+//   Bus     request: u32 bus              response: f64 route_length, f64 curvature,
+//                                                   u32 stop_count, u32 unique_stop_count
+//   Stop    request: u32 stop             response: u32 n, n * u32 bus
+//   Route   request: u32 from, u32 to     response: f64 total_time, u32 n, n * item
+//   Map     request: -                    response: string (svg)
+//   Error   -                             response: - (not found)
+//
+// Stops and buses are referred to by the ids listed in the Names response.
+// A route item is u8 RouteItemType, f64 time, u32 stop or bus id and, for
+// Bus items only, u32 span_count.
+//
+// A request that is too short for its type or larger than MAX_FRAME_SIZE
+// is answered with Error; only a stream that ends inside a frame is fatal.
+namespace Binary {
+
+enum class MessageType : uint8_t
+{
+    Names = 0,
+    Bus = 1,
+    Stop = 2,
+    Route = 3,
+    Map = 4,
+    Error = 0xFF
+};
+
+enum class RouteItemType : uint8_t
+{
+    Wait = 1,
+    Bus = 2
+};
+
+// Requests are tiny; anything larger is skipped instead of buffered.
+static const uint32_t MAX_FRAME_SIZE = 64 * 1024;
+
+// Thrown by Reader when a payload ends before the message does.
+class DecodeError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+class Reader
+{
+    std::string_view data_;
+    size_t pos_ = 0;
+
+    std::string_view Take(size_t size);
+
+public:
+    explicit Reader(std::string_view data);
+
+    uint8_t U8();
+    uint32_t U32();
+    double F64();
+    std::string_view String();
+};
+
+class Writer
+{
+    std::string buffer_;
+
+public:
+    Writer& Begin(MessageType type, uint32_t requestId);
+
+    Writer& U8(uint8_t val);
+    Writer& U32(uint32_t val);
+    Writer& F64(double val);
+    Writer& String(std::string_view val);
+
+    void Flush(std::ostream& stream);
+};
+
+enum class Frame
+{
+    End,
+    Complete,
+    // Larger than MAX_FRAME_SIZE: payload holds at most the type and request
+    // id, the rest of the frame is skipped.
+    TooLarge
+};
+
+// Reads the next frame into payload. Throws std::out_of_range if the
+// stream ends inside a frame.
+Frame ReadFrame(std::istream& stream, std::string& payload);
+
+}
+
+#endif // BINARY_PROTOCOL_H
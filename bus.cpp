@@ -1,112 +1,125 @@
+#include <algorithm>
+
 #include "bus.h"
 #include "bus_station.h"
+#include "responses.h"
+#include "parallel.h"
 
 using namespace std;
 
-Bus::Bus(string name, vector<StationPtr> stations, bool isLooped) :
-    name_(move(name)),
-    isLooped_(isLooped),
-    stations_(move(stations))
-{}
+pair<BusId, bool> Buses::add(string_view name, const vector<StationId>& stops, bool isLooped)
+{
+    auto [id, inserted] = names_.add(name);
+    if(inserted)
+    {
+        looped_.push_back(isLooped);
+        stops_.insert(stops_.end(), stops.begin(), stops.end());
+        stopStart_.push_back(uint32_t(stops_.size()));
+    }
 
-Bus::Bus(string name, bool isLooped) :
-    name_(move(name)),
-    isLooped_(isLooped)
-{}
+    return { id, inserted };
+}
 
-const string& Bus::getName() const
+size_t Buses::size() const
 {
-    return name_;
+    return names_.size();
 }
 
-const vector<Bus::StationPtr>& Bus::getStations() const
+optional<BusId> Buses::find(string_view name) const
 {
-    return stations_;
+    return names_.find(name);
 }
 
-
-size_t Bus::getUniqueStations()
+BusId Buses::at(string_view name) const
 {
-    if(uniqueStations_.size())
-        return uniqueStations_.size();
+    if(auto id = names_.find(name); id.has_value())
+        return id.value();
 
-    for(auto & x : stations_)
-    {
-        uniqueStations_.emplace(x->getName());
-    }
-    return uniqueStations_.size();
+    throw out_of_range("Buses::at");
 }
 
-bool Bus::isLooped() const
+const vector<BusId>& Buses::byName() const
 {
-    return isLooped_;
+    return names_.sorted();
 }
 
-void Bus::addStation(shared_ptr<BusStation> station)
+const string_view& Buses::getName(BusId id) const
 {
-    stations_.push_back(station);
+    return names_[id];
 }
 
-size_t Bus::getRealLength()
+bool Buses::isLooped(BusId id) const
 {
-    if(realLength_)
-        return realLength_.value();
-    realLength_ = 0.0;
-
-    for(auto it = stations_.begin() + 1; it != stations_.end(); it++)
-    {
-        if(auto dist = (*(it - 1))->getDistance(*it); dist.has_value())
-            realLength_ = realLength_.value() + dist.value();
-    }
-
-    if(isLooped_)
-        return realLength_.value();
-
-    for(auto it = stations_.rbegin() + 1; it != stations_.rend(); it++)
-    {
-        if(auto dist = (*(it - 1))->getDistance(*it); dist.has_value())
-            realLength_ = realLength_.value() + dist.value();
-    }
-
-    return realLength_.value();
+    return looped_[id];
 }
 
-double Bus::getGlobalLength()
+IdRange<StationId> Buses::getStops(BusId id) const
 {
-    if(globalLength_)
-        return globalLength_.value();
-    globalLength_ = 0.0;
-
-    for(auto it = stations_.begin() + 1; it != stations_.end(); it++)
-    {
-        globalLength_ = globalLength_.value() + (**it - **(it - 1));
-    }
-
-    if(isLooped_)
-        return globalLength_.value();
-
-    globalLength_.value() *= 2;
+    return { stops_, stopStart_, id };
+}
 
-    return globalLength_.value();
+void Buses::indexStats(const BusStations& stations)
+{
+    size_t first = stats_.size();
+    auto chunks = Parallel::MapChunks(size() - first, [this, &stations, first](size_t begin, size_t end) {
+        vector<Stats> stats;
+        stats.reserve(end - begin);
+        for(size_t i = begin; i < end; i++)
+            stats.push_back(computeStats(BusId(first + i), stations));
+
+        return stats;
+    });
+
+    stats_.reserve(size());
+    for(const auto& chunk : chunks)
+        stats_.insert(stats_.end(), chunk.begin(), chunk.end());
 }
 
-size_t Bus::getStationCount() const
+const Buses::Stats& Buses::getStats(BusId id) const
 {
-    return isLooped_ ? stations_.size() : stations_.size() * 2 - 1;
+    return stats_[id];
 }
 
-double Bus::getCurvature()
+Buses::Stats Buses::computeStats(BusId id, const BusStations& stations) const
 {
-    return getRealLength() / getGlobalLength();
+    auto stops = getStops(id);
+    bool looped = looped_[id];
+
+    double realLength = 0.0;
+    for(size_t i = 1; i < stops.size(); i++)
+        if(auto dist = stations.getDistance(stops[i - 1], stops[i]); dist.has_value())
+            realLength += dist.value();
+    if(!looped)
+        for(size_t i = stops.size(); i-- > 1;)
+            if(auto dist = stations.getDistance(stops[i], stops[i - 1]); dist.has_value())
+                realLength += dist.value();
+
+    double globalLength = 0.0;
+    for(size_t i = 1; i < stops.size(); i++)
+        globalLength += stations.getGlobalDistance(stops[i - 1], stops[i]);
+    if(!looped)
+        globalLength *= 2;
+
+    vector<StationId> unique(stops.begin(), stops.end());
+    sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+
+    return {
+        realLength,
+        realLength / globalLength,
+        uint32_t(looped ? stops.size() : stops.size() * 2 - 1),
+        uint32_t(unique.size())
+    };
 }
 
-void Bus::printInJson(size_t req_id, Json::JsonArray<Json::JsonBase>& obj)
+void Buses::printInJson(BusId id, size_t req_id, Json::JsonArray<Json::JsonBase>& obj) const
 {
-    obj.BeginObject()
-        .Key("route_length").Double(getRealLength())
-        .Key("request_id").Integer(req_id)
-        .Key("curvature").Double(getCurvature())
-        .Key("stop_count").Integer(getStationCount())
-        .Key("unique_stop_count").Integer(getUniqueStations())
-        .EndObject();
+    const auto& stats = stats_[id];
+    obj.Value(BusResponse{
+        stats.routeLength,
+        int64_t(req_id),
+        stats.curvature,
+        int64_t(stats.stopCount),
+        int64_t(stats.uniqueStopCount)
+    });
 }
@@ -2,50 +2,62 @@
 #define BUS_H
 
 #include <string_view>
+#include <functional>
 #include <optional>
-#include <iostream>
 #include <string>
-#include <memory>
 #include <vector>
-#include <set>
 
 #include "json_serialize.hpp"
+#include "name_index.h"
+#include "ids.h"
 
-class BusStation;
+class BusStations;
 
-class Bus
+// All buses, by id, one array per attribute. Stops are kept by id in one
+// array for all buses. A bus added again under a name already known is
+// dropped.
+class Buses
 {
 public:
-
-protected:
-    using StationPtr = std::shared_ptr<BusStation>;
-
-    std::string name_;
-    bool isLooped_;
-
-    std::vector<StationPtr> stations_;
-    std::set<std::string_view> uniqueStations_;
-    std::optional<size_t> realLength_;
-    std::optional<double> globalLength_;
-
+    struct Stats
+    {
+        double routeLength;
+        double curvature;
+        uint32_t stopCount;
+        uint32_t uniqueStopCount;
+    };
+
+private:
+    NameIndex names_;
+    std::vector<bool> looped_;
+    // Stops of bus id in riding order are stops_[stopStart_[id] .. stopStart_[id + 1]).
+    std::vector<uint32_t> stopStart_ = { 0 };
+    std::vector<StationId> stops_;
+    // Stats by id, for the buses indexed so far; never changed once computed.
+    std::vector<Stats> stats_;
+
+    Stats computeStats(BusId id, const BusStations& stations) const;
 
 public:
-    Bus(std::string name, std::vector<StationPtr> stations, bool isLooped = false);
-    Bus(std::string name, bool isLooped = false);
-
-    void addStation(std::shared_ptr<BusStation> station);
-
-    virtual size_t getRealLength();
-    virtual double getGlobalLength();
-    virtual size_t getStationCount() const;
-
-    const std::vector<StationPtr>& getStations() const;
-    const std::string& getName() const;
-    double getCurvature();
-    size_t getUniqueStations();
-    bool isLooped() const;
-
-    void printInJson(size_t req_id, Json::JsonArray<Json::JsonBase>& obj);
+    // The id of the bus and whether it is a new one.
+    std::pair<BusId, bool> add(std::string_view name, const std::vector<StationId>& stops, bool isLooped);
+
+    size_t size() const;
+    std::optional<BusId> find(std::string_view name) const;
+    // Throws std::out_of_range for unknown names.
+    BusId at(std::string_view name) const;
+    // All ids in name order.
+    const std::vector<BusId>& byName() const;
+
+    const std::string_view& getName(BusId id) const;
+    bool isLooped(BusId id) const;
+    IdRange<StationId> getStops(BusId id) const;
+    // Computes the stats of the buses added since the last call, in
+    // parallel; needs the road distances of the stops to be indexed.
+    void indexStats(const BusStations& stations);
+    const Stats& getStats(BusId id) const;
+
+    void printInJson(BusId id, size_t req_id, Json::JsonArray<Json::JsonBase>& obj) const;
 };
 
 #endif // BUS_H
@@ -1,101 +1,167 @@
+#include <algorithm>
 #include <cmath>
+#include <tuple>
 
 #include "json_serialize.hpp"
+#include "responses.h"
 #include "bus_station.h"
 #include "bus.h"
 
 using namespace std;
 
-BusStation::BusStation(string name, double latitude, double longitude) :
-    name_(name),
-    latitude_(latitude),
-    longitude_(longitude)
-{}
-
-bool BusStation::setWaitVertex(size_t vertexID)
+pair<StationId, bool> BusStations::add(string_view name, double latitude, double longitude)
 {
-    if(!waitVertex_.has_value())
+    auto [id, inserted] = names_.add(name);
+    if(inserted)
     {
-        waitVertex_ = vertexID;
-        return true;
+        latitudes_.push_back(latitude);
+        longitudes_.push_back(longitude);
+        busStart_.push_back(busStart_.back());
     }
-    return false;
+
+    return { id, inserted };
 }
 
-size_t BusStation::getWaitVertex() const
+void BusStations::addDistance(StationId id, string_view station, size_t distance)
 {
-    return waitVertex_.value();
+    roads_.push_back({ id, station, uint32_t(distance) });
 }
 
-bool BusStation::setMainVertex(size_t vertexID)
+void BusStations::indexDistances()
 {
-    if(!mainVertex_.has_value())
+    // Every road both ways; when a pair has distances given both ways, the
+    // reversed ones sort after the given one and are dropped, as are later
+    // repeats of a road.
+    struct Entry
+    {
+        StationId from;
+        StationId to;
+        bool reversed;
+        uint32_t distance;
+    };
+    for(const auto& road : roads_)
+        if(auto to = find(road.to); to.has_value())
+            resolvedRoads_.push_back({ road.from, to.value(), road.distance });
+    roads_.clear();
+    roads_.shrink_to_fit();
+
+    vector<Entry> entries;
+    entries.reserve(2 * resolvedRoads_.size());
+    for(const auto& road : resolvedRoads_)
     {
-        mainVertex_ = vertexID;
-        return true;
+        entries.push_back({ road.from, road.to, false, road.distance });
+        entries.push_back({ road.to, road.from, true, road.distance });
     }
-    return false;
+    stable_sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+        return tie(lhs.from, lhs.to, lhs.reversed) < tie(rhs.from, rhs.to, rhs.reversed);
+    });
+
+    distanceStart_.assign(size() + 1, 0);
+    distances_.clear();
+    for(size_t i = 0; i < entries.size(); i++)
+        if(i == 0 || entries[i].from != entries[i - 1].from || entries[i].to != entries[i - 1].to)
+        {
+            distanceStart_[entries[i].from + 1]++;
+            distances_.push_back({ entries[i].to, entries[i].distance });
+        }
+    for(size_t id = 0; id < size(); id++)
+        distanceStart_[id + 1] += distanceStart_[id];
 }
 
-size_t BusStation::getMainVertex() const
+void BusStations::indexBuses(const Buses& buses)
 {
-    return mainVertex_.value();
+    // Every stop of every bus once, buses in name order; a stable sort by
+    // stop keeps them in that order within each stop.
+    vector<pair<StationId, BusId>> stops;
+    for(auto bus : buses.byName())
+    {
+        size_t first = stops.size();
+        for(auto stop : buses.getStops(bus))
+            stops.emplace_back(stop, bus);
+        sort(stops.begin() + first, stops.end());
+        stops.erase(unique(stops.begin() + first, stops.end()), stops.end());
+    }
+    stable_sort(stops.begin(), stops.end(),
+                [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+    busStart_.assign(size() + 1, 0);
+    busIds_.clear();
+    busIds_.reserve(stops.size());
+    for(const auto& [stop, bus] : stops)
+    {
+        busStart_[stop + 1]++;
+        busIds_.push_back(bus);
+    }
+    for(size_t id = 0; id < size(); id++)
+        busStart_[id + 1] += busStart_[id];
 }
 
-double BusStation::getLatitude() const
+size_t BusStations::size() const
 {
-    return latitude_;
+    return names_.size();
 }
 
-double BusStation::getLongitude() const
+optional<StationId> BusStations::find(string_view name) const
 {
-    return longitude_;
+    return names_.find(name);
 }
 
-void BusStation::addDistance(string_view station, size_t distance)
+StationId BusStations::at(string_view name) const
 {
-    distances_.insert({ station, distance });
+    if(auto id = names_.find(name); id.has_value())
+        return id.value();
+
+    throw out_of_range("BusStations::at");
 }
 
-const string& BusStation::getName() const
+const vector<StationId>& BusStations::byName() const
 {
-    return name_;
+    return names_.sorted();
 }
 
-optional<double> BusStation::getDistance(shared_ptr<BusStation> station)
+const string_view& BusStations::getName(StationId id) const
 {
-    if(auto it = distances_.find(station->getName()); it != distances_.end())
-        return it->second;
-    else if (auto it = station->distances_.find(getName()); it != station->distances_.end())
-        return it->second;
-    else
-        return nullopt;
+    return names_[id];
 }
 
-void BusStation::addBus(shared_ptr<Bus> bus)
+double BusStations::getLatitude(StationId id) const
 {
-    buses_.insert({bus->getName() , bus });
+    return latitudes_[id];
 }
 
-double BusStation::operator-(const BusStation& val) const
+double BusStations::getLongitude(StationId id) const
 {
-    double d = acos(
-                sin(val.latitude_) * sin(latitude_) +
-                cos(val.latitude_) * cos(latitude_) *
-                cos(val.longitude_ - longitude_));
-    return d * EARTH_RADIUS;
+    return longitudes_[id];
 }
 
-void BusStation::printInJson(size_t req_id, Json::JsonArray<Json::JsonBase>& obj)
+IdRange<BusId> BusStations::getBuses(StationId id) const
 {
-    auto& array = obj.BeginObject()
-                     .Key("buses")
-                     .BeginArray();
+    return { busIds_, busStart_, id };
+}
+
+optional<double> BusStations::getDistance(StationId from, StationId to) const
+{
+    for(uint32_t i = distanceStart_[from]; i < distanceStart_[from + 1]; i++)
+        if(distances_[i].to == to)
+            return distances_[i].distance;
+
+    return nullopt;
+}
 
-    for(auto & bus : buses_)
-        obj.String(bus.first);
+double BusStations::getGlobalDistance(StationId from, StationId to) const
+{
+    double d = acos(
+                sin(latitudes_[from]) * sin(latitudes_[to]) +
+                cos(latitudes_[from]) * cos(latitudes_[to]) *
+                cos(longitudes_[from] - longitudes_[to]));
+    return d * EARTH_RADIUS;
+}
 
-    array.EndArray()
-         .Key("request_id").Integer(req_id)
-         .EndObject();
+void BusStations::printInJson(StationId id, size_t req_id, const Buses& buses,
+                              Json::JsonArray<Json::JsonBase>& obj) const
+{
+    obj.Value(StopResponse{
+        Json::Mapped(getBuses(id), [&buses](BusId bus) { return buses.getName(bus); }),
+        int64_t(req_id)
+    });
 }
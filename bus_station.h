@@ -1,51 +1,95 @@
 #ifndef BUSSTATION_H
 #define BUSSTATION_H
 
-#include <unordered_map>
-#include <iostream>
+#include <string_view>
+#include <functional>
 #include <optional>
-#include <memory>
 #include <string>
 #include <vector>
-#include <set>
-#include <map>
 
 #include "json_serialize.hpp"
+#include "name_index.h"
+#include "ids.h"
 
-class Bus;
+class Buses;
 
 static const size_t  EARTH_RADIUS = 6'371'000;
 static constexpr double PI = 3.1415926535;
 
-class BusStation
+// All stops, by id, one array per attribute. A stop added again under a
+// name already known keeps its first id and coordinates.
+class BusStations
 {
+    NameIndex names_;
+    std::vector<double> latitudes_, longitudes_;
 
-    std::map<std::string_view, std::shared_ptr<Bus>> buses_;
-    std::unordered_map<std::string_view, size_t> distances_;
-    std::optional<size_t> mainVertex_, waitVertex_;
-    std::string name_;
+    // Road distances as given in the input, until they are indexed.
+    struct Road
+    {
+        StationId from;
+        std::string_view to;
+        uint32_t distance;
+    };
+    std::vector<Road> roads_;
 
-    double latitude_, longitude_;
+    // Road distances indexed so far, as given and in that order; the table
+    // below is rebuilt from them whenever more are indexed.
+    struct ResolvedRoad
+    {
+        StationId from;
+        StationId to;
+        uint32_t distance;
+    };
+    std::vector<ResolvedRoad> resolvedRoads_;
 
-public:
-    BusStation(std::string name, double latitude, double longitude);
+    // Road distances from stop id are distances_[distanceStart_[id] .. distanceStart_[id + 1]),
+    // by destination id.
+    struct Distance
+    {
+        StationId to;
+        uint32_t distance;
+    };
+    std::vector<uint32_t> distanceStart_ = { 0 };
+    std::vector<Distance> distances_;
+
+    // Buses through stop id, in name order, are busIds_[busStart_[id] .. busStart_[id + 1]).
+    std::vector<uint32_t> busStart_ = { 0 };
+    std::vector<BusId> busIds_;
 
-    double operator-(const BusStation &val) const;
+public:
+    // The id of the stop and whether it is a new one.
+    std::pair<StationId, bool> add(std::string_view name, double latitude, double longitude);
+    // The name of the other stop has to stay valid until indexDistances().
+    void addDistance(StationId id, std::string_view station, size_t distance);
+    // Resolves the distances added since the last call and indexes them
+    // with the earlier ones into a table by stop id; a stop with no distance
+    // given to another takes the one given back from it.
+    void indexDistances();
+    // Lists the buses through every stop; done again whenever buses change.
+    void indexBuses(const Buses& buses);
 
-    void printInJson(size_t req_id, Json::JsonArray<Json::JsonBase>& obj);
+    size_t size() const;
+    std::optional<StationId> find(std::string_view name) const;
+    // Throws std::out_of_range for unknown names.
+    StationId at(std::string_view name) const;
+    // All ids in name order.
+    const std::vector<StationId>& byName() const;
 
-    bool setWaitVertex(size_t vertexID);
-    bool setMainVertex(size_t vertexID);
+    const std::string_view& getName(StationId id) const;
+    double getLatitude(StationId id) const;
+    double getLongitude(StationId id) const;
+    IdRange<BusId> getBuses(StationId id) const;
+    std::optional<double> getDistance(StationId from, StationId to) const;
+    // Great-circle distance between two stops.
+    double getGlobalDistance(StationId from, StationId to) const;
 
-    void addBus(std::shared_ptr<Bus> bus);
-    void addDistance(std::string_view station, size_t distance);
+    // Every stop is a pair of graph vertices: waiting for a bus at the stop
+    // and being on board there.
+    static size_t getMainVertex(StationId id) { return size_t(id) * 2; }
+    static size_t getWaitVertex(StationId id) { return size_t(id) * 2 + 1; }
 
-    size_t getWaitVertex() const;
-    size_t getMainVertex() const;
-    double getLatitude() const;
-    double getLongitude() const;
-    const std::string &getName() const;
-    std::optional<double> getDistance(std::shared_ptr<BusStation> station);
+    void printInJson(StationId id, size_t req_id, const Buses& buses,
+                     Json::JsonArray<Json::JsonBase>& obj) const;
 };
 
 #endif // BUSSTATION_H
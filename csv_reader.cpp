@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <stdexcept>
+#include <charconv>
+#include <cstring>
+
+#include "csv_reader.h"
+
+using namespace std;
+
+namespace Csv {
+
+Reader::Reader(istream& input, size_t bufferSize) :
+    input_(input),
+    buffer_(bufferSize)
+{
+    if(!NextRow())
+        throw invalid_argument("Csv::Reader: missing header");
+
+    for(auto field : fields_)
+        header_.emplace_back(field);
+}
+
+bool Reader::Fill()
+{
+    if(begin_ > 0)
+    {
+        memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+    }
+
+    // A row longer than the whole buffer: grow it rather than split the row.
+    if(end_ == buffer_.size())
+        buffer_.resize(buffer_.size() * 2);
+
+    input_.read(buffer_.data() + end_, buffer_.size() - end_);
+    end_ += input_.gcount();
+
+    return input_.gcount() > 0;
+}
+
+bool Reader::NextRow()
+{
+    char* rowBegin;
+    char* rowEnd;
+
+    do
+    {
+        size_t pos = begin_;
+        bool quoted = false;
+
+        for(;;)
+        {
+            for(; pos < end_; pos++)
+            {
+                if(buffer_[pos] == '"')
+                    quoted = !quoted;
+                else if(buffer_[pos] == '\n' && !quoted)
+                    break;
+            }
+
+            if(pos < end_)
+                break;
+
+            size_t scanned = pos - begin_;
+            bool filled = Fill();
+            pos = begin_ + scanned;
+            if(!filled)
+            {
+                if(begin_ == end_)
+                    return false;
+                break;  // last row without a trailing newline
+            }
+        }
+
+        rowBegin = buffer_.data() + begin_;
+        rowEnd = buffer_.data() + pos;
+        begin_ = min(pos + 1, end_);
+
+        if(rowEnd != rowBegin && rowEnd[-1] == '\r')
+            --rowEnd;
+    } while(rowBegin == rowEnd);
+
+    SplitRow(rowBegin, rowEnd);
+    return true;
+}
+
+void Reader::SplitRow(char* begin, char* end)
+{
+    fields_.clear();
+
+    for(char* field = begin; ; )
+    {
+        if(field != end && *field == '"')
+        {
+            // Quoted field: unescape "" in place, the result is never longer.
+            char* out = field;
+            char* in = field + 1;
+            for(; in != end; in++)
+            {
+                if(*in == '"')
+                {
+                    if(in + 1 != end && in[1] == '"')
+                        ++in;
+                    else
+                    {
+                        ++in;
+                        break;
+                    }
+                }
+                *out++ = *in;
+            }
+            fields_.emplace_back(field, out - field);
+            field = find(in, end, ',');
+        } else
+        {
+            char* next = find(field, end, ',');
+            fields_.emplace_back(field, next - field);
+            field = next;
+        }
+
+        if(field == end)
+            break;
+        ++field;
+    }
+}
+
+size_t Reader::Column(string_view name) const
+{
+    auto it = find(header_.begin(), header_.end(), name);
+    if(it == header_.end())
+        throw out_of_range("Csv::Reader: no column " + string(name));
+    return it - header_.begin();
+}
+
+string_view Reader::Field(size_t column) const
+{
+    return column < fields_.size() ? fields_[column] : string_view();
+}
+
+int ParseInt(string_view field)
+{
+    int val = 0;
+    if(from_chars(field.data(), field.data() + field.size(), val).ec != errc())
+        throw invalid_argument("Csv: not an integer: " + string(field));
+    return val;
+}
+
+double ParseDouble(string_view field)
+{
+    double val = 0.0;
+    if(from_chars(field.data(), field.data() + field.size(), val).ec != errc())
+        throw invalid_argument("Csv: not a number: " + string(field));
+    return val;
+}
+
+bool ParseBool(string_view field)
+{
+    return field == "1" || field == "true";
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef CSV_READER_H
+#define CSV_READER_H
+
+#include <string_view>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Csv {
+
+// Reads comma separated rows from a stream in fixed-size chunks, without
+// ever holding more than the current chunk in memory. The first row is
+// taken as the header. Fields of the current row are views into the chunk
+// buffer and stay valid until the next call to NextRow.
+class Reader
+{
+    std::istream& input_;
+    std::vector<char> buffer_;
+    size_t begin_ = 0, end_ = 0;
+    std::vector<std::string_view> fields_;
+    std::vector<std::string> header_;
+
+    bool Fill();
+    void SplitRow(char* begin, char* end);
+
+public:
+    static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+    explicit Reader(std::istream& input, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+    bool NextRow();
+
+    size_t Column(std::string_view name) const;
+    std::string_view Field(size_t column) const;
+};
+
+// A GTFS-like network description, one stream per file:
+//   stops:          stop_id, stop_name, stop_lat, stop_lon
+//   routes:         route_id, route_short_name, is_roundtrip
+//   route_stops:    route_id, stop_sequence, stop_id
+//   road_distances: from_stop_id, to_stop_id, distance
+// Columns are looked up by header name and may come in any order.
+struct Feed
+{
+    std::istream& stops;
+    std::istream& routes;
+    std::istream& routeStops;
+    std::istream& roadDistances;
+};
+
+int ParseInt(std::string_view field);
+double ParseDouble(std::string_view field);
+bool ParseBool(std::string_view field);
+
+}
+
+#endif // CSV_READER_H
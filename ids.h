@@ -0,0 +1,41 @@
+#ifndef IDS_H
+#define IDS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Stops and buses are numbered densely from 0 in the order they are added.
+using StationId = uint32_t;
+using BusId = uint32_t;
+
+// A run of ids stored contiguously, as the stops of a bus or the buses of
+// a stop.
+template <typename Id>
+class IdRange
+{
+    const Id* begin_;
+    const Id* end_;
+
+public:
+    IdRange(const Id* begin, const Id* end) :
+        begin_(begin),
+        end_(end)
+    {}
+
+    // Items of item i are items[start[i] .. start[i + 1]).
+    IdRange(const std::vector<Id>& items, const std::vector<uint32_t>& start, size_t i) :
+        begin_(items.data() + start[i]),
+        end_(items.data() + start[i + 1])
+    {}
+
+    const Id* begin() const { return begin_; }
+    const Id* end() const { return end_; }
+    size_t size() const { return size_t(end_ - begin_); }
+    bool empty() const { return begin_ == end_; }
+    Id front() const { return *begin_; }
+    Id back() const { return *(end_ - 1); }
+    Id operator[](size_t i) const { return begin_[i]; }
+};
+
+#endif // IDS_H
@@ -1,33 +1,40 @@
 #include "json.h"
 #include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cerrno>
+#include <limits>
 
 using namespace std;
 namespace Json {
 
-  Document::Document(Node root) : root(move(root)) {
+  static const size_t ARENA_INITIAL_SIZE = 64 * 1024;
+
+  Document::Document() :
+      arena(make_unique<pmr::monotonic_buffer_resource>(ARENA_INITIAL_SIZE)) {
   }
 
   const Node& Document::GetRoot() const {
-    return root;
+    return *root;
   }
 
-  Node LoadNode(istream& input);
+  Node LoadNode(istream& input, pmr::memory_resource* arena);
 
-  Node LoadArray(istream& input) {
-    vector<Node> result;
+  Node LoadArray(istream& input, pmr::memory_resource* arena) {
+    Array result(arena);
 
     for (char c; input >> c && c != ']'; ) {
       if (c != ',') {
         input.putback(c);
       }
-      result.push_back(LoadNode(input));
+      result.push_back(LoadNode(input, arena));
     }
 
     return Node(move(result));
   }
 
-  Node LoadNumeric(istream& input) {
-    string num;
+  Node LoadNumeric(istream& input, pmr::memory_resource* arena) {
+    String num(arena);
     while(isdigit(input.peek()) || input.peek() == '.' || input.peek() == '-')
     {
         char next;
@@ -36,9 +43,18 @@ namespace Json {
     }
 
     if(num.find('.') != num.npos)
-        return Node(stod(num));
-    else
-        return Node(stoi(num));
+        return Node(strtod(num.c_str(), nullptr));
+
+    // Same failures as std::stoi: no digits, or a value an int cannot hold.
+    char* end = nullptr;
+    errno = 0;
+    long val = strtol(num.c_str(), &end, 10);
+    if(end == num.c_str())
+        throw invalid_argument("Json: invalid integer");
+    if(errno == ERANGE || val < numeric_limits<int>::min() || val > numeric_limits<int>::max())
+        throw out_of_range("Json: integer out of range");
+
+    return Node(int(val));
   }
 
   Node LoadBoolean(istream & input)
@@ -57,41 +73,41 @@ namespace Json {
           return Node(false);
   }
 
-  Node LoadString(istream& input) {
-    string line;
+  String LoadString(istream& input, pmr::memory_resource* arena) {
+    String line(arena);
     getline(input, line, '"');
-    return Node(move(line));
+    return line;
   }
 
-  Node LoadDict(istream& input) {
-    map<string, Node> result;
+  Node LoadDict(istream& input, pmr::memory_resource* arena) {
+    Dict::Entries result(arena);
 
     for (char c; input >> c && c != '}'; ) {
       if (c == ',') {
         input >> c;
       }
 
-      string key = LoadString(input).AsString();
+      String key = LoadString(input, arena);
       input >> c;
-      result.emplace(move(key), LoadNode(input));
+      result.emplace_back(move(key), LoadNode(input, arena));
     }
 
-    return Node(move(result));
+    return Node(Dict(move(result)));
   }
 
-  Node LoadNode(istream& input) {
+  Node LoadNode(istream& input, pmr::memory_resource* arena) {
     char c;
     input >> c;
 
     if (c == '[') {
-      return LoadArray(input);
+      return LoadArray(input, arena);
     } else if (c == '{') {
-      return LoadDict(input);
+      return LoadDict(input, arena);
     } else if (c == '"') {
-      return LoadString(input);
+      return Node(LoadString(input, arena));
     } else if(isdigit(c) || c == '-'){
       input.putback(c);
-      return LoadNumeric(input);
+      return LoadNumeric(input, arena);
     } else {
       input.putback(c);
       return LoadBoolean(input);
@@ -99,7 +115,15 @@ namespace Json {
   }
 
   Document Load(istream& input) {
-    return Document{LoadNode(input)};
+    Document document;
+    pmr::polymorphic_allocator<Node> allocator(document.arena.get());
+
+    // The root lives in the arena too and is never destroyed explicitly:
+    // every byte it owns is released together with the arena.
+    document.root = allocator.allocate(1);
+    new (document.root) Node(LoadNode(input, document.arena.get()));
+
+    return document;
   }
 
 }
@@ -1,40 +1,77 @@
 #ifndef JSON_H
 #define JSON_H
 
+#include <memory_resource>
+#include <string_view>
+#include <algorithm>
+#include <stdexcept>
 #include <variant>
 #include <functional>
+#include <utility>
+#include <memory>
 #include <string>
 #include <vector>
-#include <map>
 
 namespace Json {
 
-  class Node : std::variant<std::vector<Node>,
-                            std::map<std::string, Node>,
+  class Node;
+
+  // All containers of a parsed tree draw their storage from the arena owned
+  // by the Document they belong to.
+  using String = std::pmr::string;
+  using Array = std::pmr::vector<Node>;
+
+  // Object members stored contiguously and sorted by key. Objects in the
+  // input are small, so a binary search over adjacent entries beats
+  // chasing the nodes of a tree.
+  class Dict {
+  public:
+    using Entry = std::pair<String, Node>;
+    using Entries = std::pmr::vector<Entry>;
+    using const_iterator = Entries::const_iterator;
+
+    // Takes members in input order; for repeated keys the first one wins.
+    explicit Dict(Entries entries);
+
+    const Node& at(std::string_view key) const;
+    const_iterator find(std::string_view key) const;
+    size_t count(std::string_view key) const;
+
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+  private:
+    Entries entries_;
+  };
+
+  class Node : std::variant<Array,
+                            Dict,
                             int,
                             double,
                             bool,
-                            std::string> {
+                            String> {
   public:
     using variant::variant;
 
     bool IsArray() const {
-        return std::holds_alternative<std::vector<Node>>(*this);
+        return std::holds_alternative<Array>(*this);
     }
 
     bool IsMap() const {
-        return std::holds_alternative<std::map<std::string, Node>>(*this);
+        return std::holds_alternative<Dict>(*this);
     }
 
     bool IsString() const {
-        return std::holds_alternative<std::string>(*this);
+        return std::holds_alternative<String>(*this);
     }
 
     const auto& AsArray() const {
-      return std::get<std::vector<Node>>(*this);
+      return std::get<Array>(*this);
     }
     const auto& AsMap() const {
-      return std::get<std::map<std::string, Node>>(*this);
+      return std::get<Dict>(*this);
     }
 
     double AsDouble() const {
@@ -52,18 +89,57 @@ namespace Json {
     }
 
     const auto& AsString() const {
-      return std::get<std::string>(*this);
+      return std::get<String>(*this);
     }
   };
 
+  inline Dict::Dict(Entries entries) : entries_(std::move(entries)) {
+    const auto byKey = [](const Entry& lhs, const Entry& rhs) {
+      return lhs.first < rhs.first;
+    };
+    const auto sameKey = [](const Entry& lhs, const Entry& rhs) {
+      return lhs.first == rhs.first;
+    };
+
+    // Stable insertion in place: std::stable_sort would grab a temporary
+    // buffer from the heap for every object.
+    for (auto it = entries_.begin(); it != entries_.end(); ++it)
+      std::rotate(std::upper_bound(entries_.begin(), it, *it, byKey), it, it + 1);
+    entries_.erase(std::unique(entries_.begin(), entries_.end(), sameKey), entries_.end());
+  }
+
+  inline Dict::const_iterator Dict::find(std::string_view key) const {
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), key,
+                               [](const Entry& entry, std::string_view key) {
+                                 return std::string_view(entry.first) < key;
+                               });
+    return it != entries_.end() && it->first == key ? it : entries_.end();
+  }
+
+  inline const Node& Dict::at(std::string_view key) const {
+    if (auto it = find(key); it != entries_.end())
+      return it->second;
+    throw std::out_of_range("Json::Dict::at");
+  }
+
+  inline size_t Dict::count(std::string_view key) const {
+    return find(key) != entries_.end();
+  }
+
+  // Owns the bump arena every node, container and string of the tree is
+  // allocated from. The tree is never destroyed node by node: releasing the
+  // arena frees the whole document at once.
   class Document {
   public:
-    explicit Document(Node root);
-
     const Node& GetRoot() const;
 
   private:
-    Node root;
+    friend Document Load(std::istream& input);
+
+    Document();
+
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
+    Node* root = nullptr;
   };
 
   Document Load(std::istream& input);
@@ -0,0 +1,111 @@
+#include "json_escape.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define JSON_ESCAPE_X86
+#include <immintrin.h>
+#endif
+
+namespace Json {
+
+namespace {
+
+bool NeedsEscape(unsigned char c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+size_t FindEscapeScalar(const char* str, size_t pos, size_t size)
+{
+    while(pos < size && !NeedsEscape(str[pos]))
+        pos++;
+    return pos;
+}
+
+#ifdef JSON_ESCAPE_X86
+
+// Bytes not above 0x1F are the ones left unchanged by an unsigned min
+// with 0x1F; SSE2 has no unsigned byte comparison.
+size_t FindEscapeSse2(const char* str, size_t size)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    size_t pos = 0;
+    for(; pos + 16 <= size; pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + pos));
+        __m128i hits = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                    _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+        if(int mask = _mm_movemask_epi8(hits))
+            return pos + __builtin_ctz(mask);
+    }
+    return FindEscapeScalar(str, pos, size);
+}
+
+__attribute__((target("avx2")))
+size_t FindEscapeAvx2(const char* str, size_t size)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+
+    size_t pos = 0;
+    for(; pos + 32 <= size; pos += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + pos));
+        __m256i hits = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+                    _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control), chunk));
+        if(unsigned mask = unsigned(_mm256_movemask_epi8(hits)))
+            return pos + __builtin_ctz(mask);
+    }
+    return pos + FindEscapeSse2(str + pos, size - pos);
+}
+
+bool HasAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+}
+
+size_t FindEscape(const char* str, size_t size)
+{
+#ifdef JSON_ESCAPE_X86
+    static const bool avx2 = HasAvx2();
+    return avx2 ? FindEscapeAvx2(str, size) : FindEscapeSse2(str, size);
+#else
+    return FindEscapeScalar(str, 0, size);
+#endif
+}
+
+std::string_view EscapeSequence(char c, char (&buffer)[6])
+{
+    switch(c)
+    {
+    case '"':  return "\\\"";
+    case '\\': return "\\\\";
+    case '\b': return "\\b";
+    case '\f': return "\\f";
+    case '\n': return "\\n";
+    case '\r': return "\\r";
+    case '\t': return "\\t";
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    auto byte = static_cast<unsigned char>(c);
+    buffer[0] = '\\';
+    buffer[1] = 'u';
+    buffer[2] = '0';
+    buffer[3] = '0';
+    buffer[4] = digits[byte >> 4];
+    buffer[5] = digits[byte & 0xF];
+    return { buffer, 6 };
+}
+
+}
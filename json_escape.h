@@ -0,0 +1,40 @@
+#ifndef JSON_ESCAPE_H
+#define JSON_ESCAPE_H
+
+#include <string_view>
+#include <cstddef>
+
+namespace Json {
+
+// Position of the first byte in [str, str + size) that cannot appear in a
+// JSON string as it is: a quote, a backslash or a control character.
+// Returns size if there is none. Scans 32 or 16 bytes at a time where the
+// CPU allows it.
+size_t FindEscape(const char* str, size_t size);
+
+// Escape sequence for a byte FindEscape stopped at, built in buffer.
+std::string_view EscapeSequence(char c, char (&buffer)[6]);
+
+// Appends str to out with every byte escaped that has to be. Out provides
+// Append(const char*, size_t), as Io::OutputBuffer does; clean runs are
+// copied in one piece.
+template <typename Out>
+void WriteEscaped(Out& out, std::string_view str)
+{
+    while(!str.empty())
+    {
+        size_t clean = FindEscape(str.data(), str.size());
+        out.Append(str.data(), clean);
+        if(clean == str.size())
+            break;
+
+        char buffer[6];
+        auto sequence = EscapeSequence(str[clean], buffer);
+        out.Append(sequence.data(), sequence.size());
+        str.remove_prefix(clean + 1);
+    }
+}
+
+}
+
+#endif // JSON_ESCAPE_H
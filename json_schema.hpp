@@ -0,0 +1,217 @@
+#ifndef JSON_SCHEMA_HPP
+#define JSON_SCHEMA_HPP
+
+#include <type_traits>
+#include <string_view>
+#include <cstdint>
+#include <utility>
+#include <array>
+#include <tuple>
+
+#include "json_serialize.hpp"
+
+// Serialization of types with a fixed shape. A type lists its fields once:
+//
+//   struct Response
+//   {
+//       double time;
+//       static constexpr auto Schema = std::make_tuple(
+//           Json::Member("time", &Response::time),
+//           Json::Constant("type", "Wait"));
+//   };
+//
+// Keys are turned into their final bytes, quotes, colon and separator
+// included, at compile time; only the values are formatted at runtime.
+namespace Json {
+
+// ,"name": with the leading separator dropped for the first field.
+template <size_t N>
+class KeyLiteral
+{
+    std::array<char, N + 3> bytes_ {};
+
+public:
+    constexpr explicit KeyLiteral(const char (&name)[N])
+    {
+        bytes_[0] = ',';
+        bytes_[1] = '"';
+        for(size_t i = 0; i + 1 < N; i++)
+            bytes_[i + 2] = name[i];
+        bytes_[N + 1] = '"';
+        bytes_[N + 2] = ':';
+    }
+
+    constexpr std::string_view Get(bool first) const
+    {
+        return first ? std::string_view(bytes_.data() + 1, N + 2)
+                     : std::string_view(bytes_.data(), N + 3);
+    }
+};
+
+// ,"name":"value" for members that never change; the value is copied
+// verbatim and must not need escaping.
+template <size_t N, size_t M>
+class ConstantLiteral
+{
+    std::array<char, N + M + 4> bytes_ {};
+
+public:
+    constexpr ConstantLiteral(const char (&name)[N], const char (&value)[M])
+    {
+        KeyLiteral<N> key(name);
+        auto keyBytes = key.Get(false);
+        for(size_t i = 0; i < keyBytes.size(); i++)
+            bytes_[i] = keyBytes[i];
+        bytes_[N + 3] = '"';
+        for(size_t i = 0; i + 1 < M; i++)
+            bytes_[N + 4 + i] = value[i];
+        bytes_[N + M + 3] = '"';
+    }
+
+    constexpr std::string_view Get(bool first) const
+    {
+        return first ? std::string_view(bytes_.data() + 1, N + M + 3)
+                     : std::string_view(bytes_.data(), N + M + 4);
+    }
+};
+
+template <typename Struct, typename Type, size_t N>
+struct MemberField
+{
+    KeyLiteral<N> key;
+    Type Struct::* member;
+};
+
+template <size_t N, size_t M>
+struct ConstantField
+{
+    ConstantLiteral<N, M> literal;
+};
+
+template <typename Struct, typename Type, size_t N>
+constexpr MemberField<Struct, Type, N> Member(const char (&name)[N], Type Struct::* member)
+{
+    return { KeyLiteral<N>(name), member };
+}
+
+template <size_t N, size_t M>
+constexpr ConstantField<N, M> Constant(const char (&name)[N], const char (&value)[M])
+{
+    return { ConstantLiteral<N, M>(name, value) };
+}
+
+template <typename T, typename = void>
+struct HasSchema : std::false_type {};
+
+template <typename T>
+struct HasSchema<T, std::void_t<decltype(T::Schema)>> : std::true_type {};
+
+// Writes any value: numbers, booleans, strings, types with a Schema and
+// types providing printInJson(JsonWriter&) const.
+template <typename T>
+void Write(JsonWriter& writer, const T& val);
+
+template <bool First, typename Struct, typename Type, size_t N>
+void WriteField(JsonWriter& writer, const Struct& val, const MemberField<Struct, Type, N>& field)
+{
+    writer.RawKey(field.key.Get(First));
+    Write(writer, val.*field.member);
+}
+
+template <bool First, typename Struct, size_t N, size_t M>
+void WriteField(JsonWriter& writer, const Struct&, const ConstantField<N, M>& field)
+{
+    writer.Raw(field.literal.Get(First));
+}
+
+template <typename T, size_t... I>
+void WriteObject(JsonWriter& writer, const T& val, std::index_sequence<I...>)
+{
+    writer.BeginValue();
+    writer.Raw("{");
+    (WriteField<I == 0>(writer, val, std::get<I>(T::Schema)), ...);
+    writer.Raw("}");
+}
+
+template <typename T>
+void Write(JsonWriter& writer, const T& val)
+{
+    if constexpr (std::is_same_v<T, bool>)
+        writer.Boolean(val);
+    else if constexpr (std::is_integral_v<T>)
+        writer.Integer(val);
+    else if constexpr (std::is_floating_point_v<T>)
+        writer.Double(val);
+    else if constexpr (std::is_convertible_v<const T&, std::string_view>)
+        writer.String(val);
+    else if constexpr (HasSchema<T>::value)
+        WriteObject(writer, val, std::make_index_sequence<std::tuple_size_v<decltype(T::Schema)>>());
+    else
+        val.printInJson(writer);
+}
+
+// A value serialized beforehand, copied as it is.
+class Verbatim
+{
+    std::string_view bytes_;
+
+public:
+    explicit Verbatim(std::string_view bytes) :
+        bytes_(bytes)
+    {}
+
+    void printInJson(JsonWriter& writer) const
+    {
+        writer.BeginValue();
+        writer.Raw(bytes_);
+    }
+};
+
+// An array of func(item) for every item of a range, written without
+// materializing the mapped values.
+template <typename Range, typename Func>
+class Mapped
+{
+    const Range& range_;
+    Func func_;
+
+public:
+    Mapped(const Range& range, Func func) :
+        range_(range),
+        func_(std::move(func))
+    {}
+
+    void printInJson(JsonWriter& writer) const
+    {
+        writer.BeginArray();
+        for(const auto& item : range_)
+            Write(writer, func_(item));
+        writer.EndArray();
+    }
+};
+
+// An array of func(i) for i in [0, count).
+template <typename Func>
+class Generated
+{
+    size_t count_;
+    Func func_;
+
+public:
+    Generated(size_t count, Func func) :
+        count_(count),
+        func_(std::move(func))
+    {}
+
+    void printInJson(JsonWriter& writer) const
+    {
+        writer.BeginArray();
+        for(size_t i = 0; i < count_; i++)
+            Write(writer, func_(i));
+        writer.EndArray();
+    }
+};
+
+}
+
+#endif // JSON_SCHEMA_HPP
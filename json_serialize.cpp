@@ -1,20 +1,196 @@
+
+#include <stdexcept>
+#include <algorithm>
+#include <charconv>
+
 #include "json_serialize.hpp"
+#include "json_escape.h"
 
 namespace Json {
 
+namespace {
+
+void WriteQuoted(Io::OutputBuffer& out, std::string_view str)
+{
+    out.Push('"');
+    WriteEscaped(out, str);
+    out.Push('"');
+}
+
+}
+
+JsonWriter::JsonWriter(Io::OutputBuffer& out) :
+    out_(out)
+{}
+
+void JsonWriter::SetPrecision(std::optional<int> precision)
+{
+    precision_ = precision;
+    if(precision_.has_value())
+        precision_ = std::clamp(precision_.value(), 1, MAX_PRECISION);
+}
+
+void JsonWriter::BeginValue()
+{
+    if(afterKey_)
+    {
+        afterKey_ = false;
+        return;
+    }
+
+    if(depth_ == 0)
+        return;
+
+    if(hasItems_[depth_ - 1])
+        out_.Push(',');
+    hasItems_[depth_ - 1] = true;
+}
+
+void JsonWriter::Open(char bracket)
+{
+    if(depth_ == MAX_DEPTH)
+        throw std::length_error("Json::JsonWriter: nesting is too deep");
+
+    BeginValue();
+    out_.Push(bracket);
+    hasItems_[depth_++] = false;
+}
+
+void JsonWriter::Close(char bracket)
+{
+    --depth_;
+    out_.Push(bracket);
+}
+
+void JsonWriter::BeginArray()
+{
+    Open('[');
+}
+
+void JsonWriter::EndArray()
+{
+    Close(']');
+}
+
+void JsonWriter::BeginObject()
+{
+    Open('{');
+}
+
+void JsonWriter::EndObject()
+{
+    Close('}');
+}
+
+void JsonWriter::Key(std::string_view name)
+{
+    BeginValue();
+    WriteQuoted(out_, name);
+    out_.Push(':');
+    afterKey_ = true;
+}
+
+void JsonWriter::String(std::string_view str)
+{
+    BeginValue();
+    WriteQuoted(out_, str);
+}
+
+void JsonWriter::BeginString()
+{
+    BeginValue();
+    out_.Push('"');
+}
+
+void JsonWriter::StringPiece(std::string_view piece)
+{
+    WriteEscaped(out_, piece);
+}
+
+void JsonWriter::EndString()
+{
+    out_.Push('"');
+}
+
+void JsonWriter::Null()
+{
+    BeginValue();
+    out_.Append("null");
+}
+
+void JsonWriter::Double(double val)
+{
+    BeginValue();
+
+    char buffer[32];
+    auto result = precision_.has_value()
+            ? std::to_chars(std::begin(buffer), std::end(buffer), val, std::chars_format::general, precision_.value())
+            : std::to_chars(std::begin(buffer), std::end(buffer), val);
+    if(result.ec != std::errc())
+        result = std::to_chars(std::begin(buffer), std::end(buffer), val);
+    out_.Append(buffer, result.ptr - buffer);
+}
+
+void JsonWriter::Splice(std::string_view head, int64_t val, std::string_view tail)
+{
+    BeginValue();
+
+    char buffer[24];
+    auto result = std::to_chars(std::begin(buffer), std::end(buffer), val);
+    out_.Append(head);
+    out_.Append(buffer, result.ptr - buffer);
+    out_.Append(tail);
+}
+
+void JsonWriter::Raw(std::string_view bytes)
+{
+    out_.Append(bytes);
+}
+
+void JsonWriter::RawKey(std::string_view bytes)
+{
+    out_.Append(bytes);
+    afterKey_ = true;
+}
+
+void JsonWriter::Integer(int64_t val)
+{
+    BeginValue();
+
+    char buffer[24];
+    auto result = std::to_chars(std::begin(buffer), std::end(buffer), val);
+    out_.Append(buffer, result.ptr - buffer);
+}
+
+void JsonWriter::Boolean(bool val)
+{
+    BeginValue();
+    out_.Append(val ? "true" : "false");
+}
+
 void PrintJsonString(std::ostream& stream, std::string_view str)
 {
-    stream << quoted(str);
+    struct StreamOut
+    {
+        std::ostream& stream;
+        void Append(const char* data, size_t size) { stream.write(data, size); }
+    } out { stream };
+
+    stream.put('"');
+    WriteEscaped(out, str);
+    stream.put('"');
 }
 
-JsonArray<JsonBase> PrintJsonArray(std::ostream& stream)
+JsonArray<JsonBase> PrintJsonArray(JsonWriter& writer)
 {
-    return JsonArray<JsonBase>(stream);
+    writer.BeginArray();
+    return JsonArray<JsonBase>(writer);
 }
 
-JsonObject<JsonBase> PrintJsonObject(std::ostream& stream)
+JsonObject<JsonBase> PrintJsonObject(JsonWriter& writer)
 {
-    return JsonObject<JsonBase>(stream);
+    writer.BeginObject();
+    return JsonObject<JsonBase>(writer);
 }
 
 }
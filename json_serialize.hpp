@@ -1,69 +1,92 @@
 #ifndef JSON_SERIALIZE_HPP
 #define JSON_SERIALIZE_HPP
 
+#include <string_view>
 #include <iostream>
 #include <optional>
-#include <iomanip>
-#include <variant>
-#include <vector>
-#include <memory>
-#include <queue>
+#include <cstdint>
+#include <array>
+
+#include "output_sink.h"
 
 namespace Json {
 
-class JsonBase
+// Writes JSON to the output buffer as soon as a value is added. Only a
+// small fixed stack of the open containers is kept, to know where the
+// separators go, so memory use does not depend on how much has been
+// written.
+class JsonWriter
 {
-protected:
-    JsonBase* parent_;
-    std::queue<std::unique_ptr<JsonBase>> vals_;
-    std::ostream& stream_;
-    bool is_ended_ = false;
-
-    JsonBase(std::ostream& stream, JsonBase* parent = nullptr) :
-        parent_(parent),
-        stream_(stream)
-    {}
+public:
+    static const size_t MAX_DEPTH = 32;
+    // Enough significant digits for any double to read back unchanged.
+    static constexpr int MAX_PRECISION = 17;
+
+private:
+    Io::OutputBuffer& out_;
+    std::optional<int> precision_;
+    std::array<bool, MAX_DEPTH> hasItems_ {};
+    size_t depth_ = 0;
+    bool afterKey_ = false;
 
+    void Open(char bracket);
+    void Close(char bracket);
 
 public:
-    virtual ~JsonBase() = default;
-    void PushValue(std::unique_ptr<JsonBase> val)
-    {
-        vals_.push(move(val));
-    }
-    std::ostream& GetStream()
-    {
-        return stream_;
-    }
+    explicit JsonWriter(Io::OutputBuffer& out);
+
+    // Doubles are written in the shortest form that reads back to the same
+    // value unless a number of significant digits is set here. The number
+    // is clamped to 1..MAX_PRECISION.
+    void SetPrecision(std::optional<int> precision);
+
+    void BeginArray();
+    void EndArray();
+    void BeginObject();
+    void EndObject();
+    void Key(std::string_view name);
+
+    void String(std::string_view str);
+
+    // A string value written in pieces, each escaped as it arrives.
+    void BeginString();
+    void StringPiece(std::string_view piece);
+    void EndString();
+
+    void Null();
+    void Double(double val);
+    void Integer(int64_t val);
+    void Boolean(bool val);
+
+    // Writes a value that was serialized beforehand, with an integer
+    // spliced in between its two halves.
+    void Splice(std::string_view head, int64_t val, std::string_view tail);
+
+    // Building blocks for serializers that bake keys and punctuation in at
+    // compile time (see json_schema.hpp): BeginValue() places the separator
+    // for a new value, Raw() copies bytes as they are and RawKey() copies a
+    // complete key, so that the next value is not preceded by a separator.
+    void BeginValue();
+    void Raw(std::string_view bytes);
+    void RawKey(std::string_view bytes);
 };
 
-class JsonValue : public JsonBase, public std::variant<std::monostate, std::string_view, bool, std::int64_t, double>
+// The classes below only tie a writer to a position in the document, so
+// that the fluent BeginObject().Key(...).Double(...).EndObject() chains are
+// checked at compile time. They are cheap values and never own anything.
+class JsonBase
 {
+protected:
+    JsonWriter* writer_;
+
 public:
-    JsonValue(std::ostream& stream, std::variant<std::monostate, std::string_view, bool, int64_t, double> val):
-        JsonBase(stream),
-        std::variant<std::monostate, std::string_view, bool, int64_t, double>(val)
+    explicit JsonBase(JsonWriter& writer) :
+        writer_(&writer)
     {}
 
-    ~JsonValue() override
-    {
-        switch (this->index()) {
-        case 0:
-            stream_ << "null";
-            break;
-        case 1:
-            stream_ << quoted(std::get<1>(*this));
-            break;
-        case 2:
-            stream_ << std::boolalpha << std::get<2>(*this);
-            break;
-        case 3:
-            stream_ << std::get<3>(*this);
-            break;
-        case 4:
-            stream_ << std::get<4>(*this);
-            break;
-        }
+    JsonWriter& GetWriter()
+    {
+        return *writer_;
     }
 };
 
@@ -75,39 +98,39 @@ class JsonAdders
         return static_cast<T&>(*this);
     }
 
-    auto& ReturnValue()
+    decltype(auto) ReturnValue()
     {
         return GetType().ValueToReturn();
     }
 
 public:
-    auto& String(std::string_view str)
+    decltype(auto) String(std::string_view str)
     {
-        GetType().PushValue(std::make_unique<JsonValue>(GetType().GetStream(), str));
+        GetType().GetWriter().String(str);
         return ReturnValue();
     }
 
-    auto& Null()
+    decltype(auto) Null()
     {
-        GetType().PushValue(std::make_unique<JsonValue>(GetType().GetStream(), std::monostate()));
+        GetType().GetWriter().Null();
         return ReturnValue();
     }
 
-    auto& Double(double val)
+    decltype(auto) Double(double val)
     {
-        GetType().PushValue(std::make_unique<JsonValue>(GetType().GetStream(), val));
+        GetType().GetWriter().Double(val);
         return ReturnValue();
     }
 
-    auto& Integer(int64_t val)
+    decltype(auto) Integer(int64_t val)
     {
-        GetType().PushValue(std::make_unique<JsonValue>(GetType().GetStream(), val));
+        GetType().GetWriter().Integer(val);
         return ReturnValue();
     }
 
-    auto& Boolean(bool val)
+    decltype(auto) Boolean(bool val)
     {
-        GetType().PushValue(std::make_unique<JsonValue>(GetType().GetStream(), val));
+        GetType().GetWriter().Boolean(val);
         return ReturnValue();
     }
 };
@@ -118,10 +141,9 @@ class JsonObject;
 template <typename T>
 class JsonArray: public JsonBase, public JsonAdders<JsonArray<T>>
 {
-
 public:
-    JsonArray(std::ostream& stream, JsonBase* parent = nullptr) :
-        JsonBase(stream, parent)
+    explicit JsonArray(JsonWriter& writer) :
+        JsonBase(writer)
     {}
 
     JsonArray<T>& ValueToReturn()
@@ -129,71 +151,61 @@ public:
         return *this;
     }
 
-    JsonArray<JsonArray<T>>& BeginArray()
+    JsonArray<JsonArray<T>> BeginArray()
+    {
+        writer_->BeginArray();
+        return JsonArray<JsonArray<T>>(*writer_);
+    }
+
+    JsonObject<JsonArray<T>> BeginObject()
     {
-        vals_.push(std::make_unique<JsonArray<JsonArray<T>>>(stream_, this));
-        return static_cast<JsonArray<JsonArray<T>>&>(*vals_.back());
+        writer_->BeginObject();
+        return JsonObject<JsonArray<T>>(*writer_);
     }
 
-    JsonObject<JsonArray<T>>& BeginObject()
+    template <typename V>
+    JsonArray<T>& Value(const V& val)
     {
-        vals_.push(std::make_unique<JsonObject<JsonArray<T>>>(stream_, this));
-        return static_cast<JsonObject<JsonArray<T>>&>(*vals_.back());
+        Write(*writer_, val);
+        return *this;
     }
 
-    T& EndArray()
+    JsonArray<T>& Splice(std::string_view head, int64_t val, std::string_view tail)
     {
-        return static_cast<T&>(*parent_);
+        writer_->Splice(head, val, tail);
+        return *this;
     }
 
-    ~JsonArray() override
+    T EndArray()
     {
-        stream_ << "[";
-        while(vals_.size() > 1)
-        {
-            vals_.pop();
-            stream_ << ',';
-        }
-        if(vals_.size())
-            vals_.pop();
-        stream_ << "]";
+        writer_->EndArray();
+        return T(*writer_);
     }
 };
 
 template <typename T>
 class JsonKey: public JsonBase, public JsonAdders<JsonKey<T>>
 {
-    std::string_view name_;
-
 public:
-    JsonKey(std::ostream& stream, std::string_view name, JsonBase* parent = nullptr) :
-        JsonBase(stream, parent),
-        name_(name)
+    explicit JsonKey(JsonWriter& writer) :
+        JsonBase(writer)
     {}
 
-    T& ValueToReturn()
-    {
-        return static_cast<T&>(*parent_);
-    }
-
-    JsonArray<T>& BeginArray()
+    T ValueToReturn()
     {
-        vals_.push(std::make_unique<JsonArray<T>>(stream_, parent_));
-        return static_cast<JsonArray<T>&>(*vals_.back());
+        return T(*writer_);
     }
 
-    JsonObject<T> &BeginObject()
+    JsonArray<T> BeginArray()
     {
-        vals_.push(std::make_unique<JsonObject<T>>(stream_, parent_));
-        return static_cast<JsonObject<T>&>(*vals_.back());
+        writer_->BeginArray();
+        return JsonArray<T>(*writer_);
     }
 
-    ~JsonKey() override
+    JsonObject<T> BeginObject()
     {
-        stream_ << quoted(name_) << ':';
-        if(vals_.size())
-            vals_.pop();
-        else stream_ << "null";
+        writer_->BeginObject();
+        return JsonObject<T>(*writer_);
     }
 };
 
@@ -201,47 +213,29 @@ template <typename T>
 class JsonObject: public JsonBase
 {
 public:
-    JsonObject(std::ostream& stream, JsonBase* parent = nullptr) :
-        JsonBase(stream, parent)
+    explicit JsonObject(JsonWriter& writer) :
+        JsonBase(writer)
     {}
 
-    JsonObject<T>& ValueToReturn()
+    JsonKey<JsonObject<T>> Key(std::string_view name)
     {
-        return *this;
-    }
-
-    JsonKey<JsonObject<T>>& Key(std::string_view name)
-    {
-        vals_.push(std::make_unique<JsonKey<JsonObject<T>>>(this->stream_, name, this));
-        return static_cast<JsonKey<JsonObject<T>>&>(*vals_.back());
+        writer_->Key(name);
+        return JsonKey<JsonObject<T>>(*writer_);
     }
 
-    T& EndObject()
+    T EndObject()
     {
-        return static_cast<T&>(*parent_);
-    }
-
-    ~JsonObject() override
-    {
-        stream_ << "{";
-        while(vals_.size() > 1)
-        {
-            vals_.pop();
-            stream_ << ',';
-        }
-        if(vals_.size())
-            vals_.pop();
-        stream_ << "}";
+        writer_->EndObject();
+        return T(*writer_);
     }
 };
 
 
 void PrintJsonString(std::ostream& stream, std::string_view str);
 
-JsonArray<JsonBase> PrintJsonArray(std::ostream& stream);
+JsonArray<JsonBase> PrintJsonArray(JsonWriter& writer);
 
-JsonObject<JsonBase> PrintJsonObject(std::ostream& stream);
+JsonObject<JsonBase> PrintJsonObject(JsonWriter& writer);
 
 }
 #endif // JSON_SERIALIZE_HPP
-
@@ -1,25 +1,88 @@
+#include <string_view>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <optional>
+#include <memory>
+#include <string>
 
 #include "transport_manager.h"
+#include "json_serialize.hpp"
+#include "output_sink.h"
 
-int main()
+int main(int argc, char* argv[])
 {
+    bool binary = false;
+    bool useIostream = false;
+    bool precompute = false;
+    std::string csvDir;
+    std::optional<int> precision;
+    for(int i = 1; i < argc; i++)
+        if(std::string_view(argv[i]) == "--binary")
+            binary = true;
+        else if(std::string_view(argv[i]) == "--iostream")
+            useIostream = true;
+        else if(std::string_view(argv[i]) == "--precompute-responses")
+            precompute = true;
+        else if(std::string_view(argv[i]) == "--csv" && i + 1 < argc)
+            csvDir = argv[++i];
+        else if(std::string_view(argv[i]) == "--precision" && i + 1 < argc)
+            precision = std::clamp(std::stoi(argv[++i]), 1, Json::JsonWriter::MAX_PRECISION);
+
     std::ifstream infile("test.json");
-    std::ofstream outfile("result.json");
     const Json::Document document(Json::Load(infile));
 
-    const auto& base_requests = document.GetRoot().AsMap().at("base_requests").AsArray();
     const auto& render_settings = document.GetRoot().AsMap().at("render_settings").AsMap();
     const auto& routing_settings = document.GetRoot().AsMap().at("routing_settings").AsMap();
 
+    // With --csv the network comes from a GTFS-like feed in the given
+    // directory instead of the base_requests array.
+    auto createManager = [&document, &csvDir]() -> TransportManager& {
+        if(csvDir.empty())
+            return TransportManager::createInstance(document.GetRoot().AsMap().at("base_requests").AsArray());
+
+        std::ifstream stops(csvDir + "/stops.txt");
+        std::ifstream routes(csvDir + "/routes.txt");
+        std::ifstream routeStops(csvDir + "/route_stops.txt");
+        std::ifstream roadDistances(csvDir + "/road_distances.txt");
+        Csv::Feed feed{ stops, routes, routeStops, roadDistances };
 
-    TransportManager& manager = TransportManager::createInstance(base_requests)
+        return TransportManager::createInstance(feed);
+    };
+
+    TransportManager& manager = createManager()
                                 .setRoutingSettings(routing_settings)
                                 .setRenderSettings(render_settings);
 
+    // Binary stat requests are read from stdin and answered on stdout
+    // instead of the stat_requests array of the input document.
+    if(binary)
+    {
+        manager.performBinaryQueries(std::cin, std::cout);
+        return 0;
+    }
+
+    // Responses are written by a background thread; --iostream falls back
+    // to a plain std::ofstream.
+    std::ofstream outfile;
+    std::unique_ptr<Io::OutputSink> sink;
+    if(useIostream)
+    {
+        outfile.open("result.json");
+        sink = std::make_unique<Io::StreamSink>(outfile);
+    } else
+        sink = std::make_unique<Io::FdSink>("result.json");
+
+    if(precompute)
+        manager.precomputeResponses(precision);
+
+    Io::OutputBuffer out(*sink);
+    Json::JsonWriter writer(out);
+    writer.SetPrecision(precision);
+
     const auto& stat_requests = document.GetRoot().AsMap().at("stat_requests").AsArray();
-    manager.performQueries(stat_requests, outfile);
+    manager.performQueries(stat_requests, writer);
+    out.Flush();
 
     return 0;
 }
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstring>
+
+#include "name_index.h"
+
+using namespace std;
+
+namespace {
+    const size_t POOL_INITIAL_SIZE = 16 * 1024;
+    const size_t INITIAL_SLOTS = 64;
+}
+
+NameIndex::NameIndex() :
+    pool_(make_unique<pmr::monotonic_buffer_resource>(POOL_INITIAL_SIZE)),
+    slots_(INITIAL_SLOTS, Slot{ 0, EMPTY })
+{}
+
+uint32_t NameIndex::hash(string_view name)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for(unsigned char c : name)
+        h = (h ^ c) * 16777619u;
+
+    return h;
+}
+
+size_t NameIndex::probe(uint32_t hash, string_view name) const
+{
+    size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    while(slots_[i].id != EMPTY &&
+          (slots_[i].hash != hash || names_[slots_[i].id] != name))
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+void NameIndex::grow()
+{
+    vector<Slot> slots(slots_.size() * 2, Slot{ 0, EMPTY });
+    size_t mask = slots.size() - 1;
+    for(const auto& slot : slots_)
+        if(slot.id != EMPTY)
+        {
+            size_t i = slot.hash & mask;
+            while(slots[i].id != EMPTY)
+                i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+
+    slots_.swap(slots);
+}
+
+pair<uint32_t, bool> NameIndex::add(string_view name)
+{
+    uint32_t h = hash(name);
+    size_t i = probe(h, name);
+    if(slots_[i].id != EMPTY)
+        return { slots_[i].id, false };
+
+    if(2 * (names_.size() + 1) > slots_.size())
+    {
+        grow();
+        i = probe(h, name);
+    }
+
+    auto* data = static_cast<char*>(pool_->allocate(max<size_t>(name.size(), 1), 1));
+    memcpy(data, name.data(), name.size());
+
+    uint32_t id = uint32_t(names_.size());
+    names_.emplace_back(data, name.size());
+    slots_[i] = { h, id };
+    sorted_.clear();
+
+    return { id, true };
+}
+
+optional<uint32_t> NameIndex::find(string_view name) const
+{
+    if(auto& slot = slots_[probe(hash(name), name)]; slot.id != EMPTY)
+        return slot.id;
+
+    return nullopt;
+}
+
+const vector<uint32_t>& NameIndex::sorted() const
+{
+    if(sorted_.size() == names_.size())
+        return sorted_;
+
+    sorted_.resize(names_.size());
+    for(uint32_t id = 0; id < sorted_.size(); id++)
+        sorted_[id] = id;
+    sort(sorted_.begin(), sorted_.end(),
+         [this](uint32_t lhs, uint32_t rhs) { return names_[lhs] < names_[rhs]; });
+
+    return sorted_;
+}
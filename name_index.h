@@ -0,0 +1,50 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <memory_resource>
+#include <string_view>
+#include <optional>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Names interned into one pool and numbered densely from 0 in the order
+// they are added, with constant-time lookup by name. Names never move once
+// added, so the views handed out stay valid for the life of the index.
+class NameIndex
+{
+    // An open-addressing table kept at most half full. Each slot keeps the
+    // hash of its name next to the id, so a probe compares names only when
+    // the hashes agree and growing the table never hashes a name again.
+    struct Slot
+    {
+        uint32_t hash;
+        uint32_t id;
+    };
+    static const uint32_t EMPTY = UINT32_MAX;
+
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> pool_;
+    std::vector<std::string_view> names_;
+    std::vector<Slot> slots_;
+    // All ids in name order, sorted on first use after a name is added.
+    mutable std::vector<uint32_t> sorted_;
+
+    static uint32_t hash(std::string_view name);
+    size_t probe(uint32_t hash, std::string_view name) const;
+    void grow();
+
+public:
+    NameIndex();
+
+    // The id of the name and whether it is a new one.
+    std::pair<uint32_t, bool> add(std::string_view name);
+
+    size_t size() const { return names_.size(); }
+    std::optional<uint32_t> find(std::string_view name) const;
+    const std::string_view& operator[](uint32_t id) const { return names_[id]; }
+    // All ids in name order. Not safe to call from several threads at
+    // once right after a name is added.
+    const std::vector<uint32_t>& sorted() const;
+};
+
+#endif // NAME_INDEX_H
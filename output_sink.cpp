@@ -0,0 +1,199 @@
+#include <system_error>
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+
+#include "output_sink.h"
+
+using namespace std;
+
+namespace Io {
+
+StreamSink::StreamSink(ostream& stream) :
+    stream_(stream)
+{}
+
+void StreamSink::Consume(string& buffer)
+{
+    stream_.write(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+void StreamSink::Flush()
+{
+    stream_.flush();
+}
+
+StringSink::StringSink(string& target) :
+    target_(target)
+{}
+
+void StringSink::Consume(string& buffer)
+{
+    target_.append(buffer);
+    buffer.clear();
+}
+
+void StringSink::Flush()
+{}
+
+FdSink::FdSink(int fd, size_t bufferCount) :
+    fd_(fd),
+    ownsFd_(false),
+    free_(max<size_t>(bufferCount, 2) - 1),
+    thread_(&FdSink::Run, this)
+{}
+
+namespace {
+
+int OpenForWriting(const string& path)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        throw system_error(errno, generic_category(), "Io::FdSink: " + path);
+    return fd;
+}
+
+}
+
+FdSink::FdSink(const string& path, size_t bufferCount) :
+    FdSink(OpenForWriting(path), bufferCount)
+{
+    ownsFd_ = true;
+}
+
+FdSink::~FdSink()
+{
+    {
+        unique_lock lock(mutex_);
+        changed_.wait(lock, [this] { return pending_.empty() && !writing_; });
+        done_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+
+    if(ownsFd_ && fd_ >= 0)
+        ::close(fd_);
+}
+
+void FdSink::Consume(string& buffer)
+{
+    {
+        unique_lock lock(mutex_);
+        changed_.wait(lock, [this] { return !free_.empty() || error_; });
+        ThrowIfFailed();
+
+        pending_.push_back(move(buffer));
+        buffer = move(free_.back());
+        free_.pop_back();
+    }
+    changed_.notify_all();
+}
+
+void FdSink::Flush()
+{
+    unique_lock lock(mutex_);
+    changed_.wait(lock, [this] { return (pending_.empty() && !writing_) || error_; });
+    ThrowIfFailed();
+}
+
+void FdSink::ThrowIfFailed()
+{
+    if(error_)
+        throw system_error(error_, generic_category(), "Io::FdSink");
+}
+
+void FdSink::Run()
+{
+    vector<string> batch;
+
+    for(;;)
+    {
+        bool failed;
+        {
+            unique_lock lock(mutex_);
+            for(auto& buffer : batch)
+            {
+                buffer.clear();
+                free_.push_back(move(buffer));
+            }
+            batch.clear();
+            writing_ = false;
+            changed_.notify_all();
+
+            changed_.wait(lock, [this] { return !pending_.empty() || done_; });
+            if(pending_.empty())
+                return;
+
+            swap(batch, pending_);
+            writing_ = true;
+            failed = error_ != 0;
+        }
+
+        // After an error the buffers are only recycled, so that the
+        // serializer gets to see the error instead of blocking forever.
+        if(!failed)
+            WriteAll(batch);
+    }
+}
+
+void FdSink::WriteAll(vector<string>& batch)
+{
+    vector<iovec> chunks;
+    for(auto& buffer : batch)
+        if(!buffer.empty())
+            chunks.push_back({ buffer.data(), buffer.size() });
+
+    for(size_t first = 0; first < chunks.size(); )
+    {
+        ssize_t written = ::writev(fd_, chunks.data() + first, int(min<size_t>(chunks.size() - first, IOV_MAX)));
+        if(written < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            lock_guard lock(mutex_);
+            error_ = errno;
+            return;
+        }
+
+        for(; first < chunks.size() && size_t(written) >= chunks[first].iov_len; first++)
+            written -= chunks[first].iov_len;
+        if(first < chunks.size())
+        {
+            chunks[first].iov_base = static_cast<char*>(chunks[first].iov_base) + written;
+            chunks[first].iov_len -= written;
+        }
+    }
+}
+
+OutputBuffer::OutputBuffer(OutputSink& sink, size_t capacity) :
+    sink_(sink),
+    capacity_(capacity)
+{
+    buffer_.reserve(capacity_);
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    try
+    {
+        Flush();
+    } catch(...)
+    {
+        // Errors are reported by an explicit Flush(); a destructor must not throw.
+    }
+}
+
+void OutputBuffer::Flush()
+{
+    if(!buffer_.empty())
+        Handoff();
+    sink_.Flush();
+}
+
+}
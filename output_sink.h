@@ -0,0 +1,129 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <condition_variable>
+#include <string_view>
+#include <iostream>
+#include <thread>
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace Io {
+
+// Destination of the byte buffers filled by serializers.
+class OutputSink
+{
+public:
+    virtual ~OutputSink() = default;
+
+    // Takes the contents of buffer and leaves an empty buffer, possibly a
+    // different one, in its place for the caller to fill next.
+    virtual void Consume(std::string& buffer) = 0;
+
+    // Returns once everything consumed so far has been written out.
+    virtual void Flush() = 0;
+};
+
+// Compatibility sink writing through a std::ostream.
+class StreamSink : public OutputSink
+{
+    std::ostream& stream_;
+
+public:
+    explicit StreamSink(std::ostream& stream);
+
+    void Consume(std::string& buffer) override;
+    void Flush() override;
+};
+
+// Appends everything to a string owned by the caller.
+class StringSink : public OutputSink
+{
+    std::string& target_;
+
+public:
+    explicit StringSink(std::string& target);
+
+    void Consume(std::string& buffer) override;
+    void Flush() override;
+};
+
+// Writes to a file descriptor from a dedicated thread, so serialization and
+// I/O overlap. A fixed pool of buffers rotates between the serializer and
+// the thread; whatever is pending when the thread wakes up goes out in a
+// single writev call.
+class FdSink : public OutputSink
+{
+    int fd_;
+    bool ownsFd_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::vector<std::string> pending_, free_;
+    bool writing_ = false, done_ = false;
+    int error_ = 0;
+
+    std::thread thread_;
+
+    void Run();
+    void WriteAll(std::vector<std::string>& batch);
+    void ThrowIfFailed();
+
+public:
+    static const size_t DEFAULT_BUFFER_COUNT = 2;
+
+    explicit FdSink(int fd, size_t bufferCount = DEFAULT_BUFFER_COUNT);
+    explicit FdSink(const std::string& path, size_t bufferCount = DEFAULT_BUFFER_COUNT);
+    ~FdSink() override;
+
+    void Consume(std::string& buffer) override;
+    void Flush() override;
+};
+
+// Byte buffer serializers append to. Appending is a plain non-virtual
+// memory copy; the sink is only involved once a whole buffer is full.
+class OutputBuffer
+{
+    OutputSink& sink_;
+    std::string buffer_;
+    size_t capacity_;
+
+    void Handoff()
+    {
+        sink_.Consume(buffer_);
+        buffer_.reserve(capacity_);
+    }
+
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+    explicit OutputBuffer(OutputSink& sink, size_t capacity = DEFAULT_CAPACITY);
+    ~OutputBuffer();
+
+    void Push(char c)
+    {
+        buffer_.push_back(c);
+        if(buffer_.size() >= capacity_)
+            Handoff();
+    }
+
+    void Append(const char* data, size_t size)
+    {
+        buffer_.append(data, size);
+        if(buffer_.size() >= capacity_)
+            Handoff();
+    }
+
+    void Append(std::string_view data)
+    {
+        Append(data.data(), data.size());
+    }
+
+    // Hands the buffer over and waits for the sink to write everything out.
+    void Flush();
+};
+
+}
+
+#endif // OUTPUT_SINK_H
@@ -0,0 +1,49 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <type_traits>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+  // Chunks smaller than this are not worth a thread of their own.
+  static const size_t MIN_CHUNK_SIZE = 256;
+
+  inline size_t ChunkCount(size_t count, size_t minChunkSize = MIN_CHUNK_SIZE) {
+    size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    size_t chunks = (count + minChunkSize - 1) / minChunkSize;
+    return std::clamp<size_t>(chunks, 1, threads);
+  }
+
+  // Splits [0, count) into contiguous chunks, runs func(begin, end) for each
+  // of them concurrently and returns the results in chunk order, so merging
+  // them stays deterministic whatever the number of threads was.
+  template <typename Func>
+  auto MapChunks(size_t count, Func func, size_t minChunkSize = MIN_CHUNK_SIZE)
+      -> std::vector<std::invoke_result_t<Func&, size_t, size_t>> {
+    using Result = std::invoke_result_t<Func&, size_t, size_t>;
+
+    const size_t chunks = ChunkCount(count, minChunkSize);
+    const size_t chunkSize = (count + chunks - 1) / std::max<size_t>(chunks, 1);
+
+    std::vector<std::future<Result>> futures;
+    for (size_t begin = chunkSize; begin < count; begin += chunkSize)
+      futures.push_back(std::async(std::launch::async, [&func, begin, end = std::min(begin + chunkSize, count)] {
+        return func(begin, end);
+      }));
+
+    std::vector<Result> results;
+    results.reserve(futures.size() + 1);
+    results.push_back(func(0, std::min(chunkSize, count)));
+    for (auto& future : futures)
+      results.push_back(future.get());
+
+    return results;
+  }
+
+}
+
+#endif // PARALLEL_H
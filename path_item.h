@@ -5,16 +5,18 @@
 #include <string_view>
 #include <sstream>
 #include <iomanip>
-#include "json_serialize.hpp"
+#include "responses.h"
 
 class PathItem
 {
+public:
     enum Type {
         WAIT,
         DRIVE,
         NONE
     };
 
+private:
     double time_;
     std::string_view name_;
     size_t spanCount_;
@@ -45,6 +47,21 @@ public:
         return time_;
     }
 
+    Type getType() const
+    {
+        return type_;
+    }
+
+    std::string_view getName() const
+    {
+        return name_;
+    }
+
+    size_t getSpanCount() const
+    {
+        return spanCount_;
+    }
+
     PathItem operator+(const PathItem& val) const
     {
         return PathItem(time_ + val.time_);
@@ -55,24 +72,21 @@ public:
         return time_ < val.time_;
     }
 
-    template<typename JsonArray>
-    void printInJson(JsonArray& arr) const
+    void printInJson(Json::JsonWriter& writer) const
     {
-        auto& obj = arr.BeginObject()
-            .Key("time").Double(time_);
-
         switch (type_) {
         case DRIVE:
-            obj.Key("span_count").Integer(spanCount_)
-               .Key("bus").String(name_)
-               .Key("type").String("Bus");
+            Json::Write(writer, BusItem{ time_, int64_t(spanCount_), name_ });
             break;
         case WAIT:
-            obj.Key("stop_name").String(name_)
-               .Key("type").String("Wait");
+            Json::Write(writer, WaitItem{ time_, name_ });
             break;
+        default:
+            writer.BeginObject();
+            writer.Key("time");
+            writer.Double(time_);
+            writer.EndObject();
         }
-        obj.EndObject();
     }
 };
 
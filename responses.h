@@ -0,0 +1,176 @@
+#ifndef RESPONSES_H
+#define RESPONSES_H
+
+#include <string_view>
+#include <cstdint>
+#include <tuple>
+
+#include "json_schema.hpp"
+#include "svg.h"
+
+// Shapes of the stat request responses. Member order is output order.
+
+struct BusResponse
+{
+    double routeLength;
+    int64_t requestId;
+    double curvature;
+    int64_t stopCount;
+    int64_t uniqueStopCount;
+
+    static constexpr auto Schema = std::make_tuple(
+        Json::Member("route_length", &BusResponse::routeLength),
+        Json::Member("request_id", &BusResponse::requestId),
+        Json::Member("curvature", &BusResponse::curvature),
+        Json::Member("stop_count", &BusResponse::stopCount),
+        Json::Member("unique_stop_count", &BusResponse::uniqueStopCount));
+};
+
+template <typename Buses>
+struct StopResponse
+{
+    Buses buses;
+    int64_t requestId;
+
+    static constexpr auto Schema = std::make_tuple(
+        Json::Member("buses", &StopResponse::buses),
+        Json::Member("request_id", &StopResponse::requestId));
+};
+
+template <typename Buses>
+StopResponse(Buses, int64_t) -> StopResponse<Buses>;
+
+template <typename Items>
+struct RouteResponse
+{
+    double totalTime;
+    int64_t requestId;
+    Items items;
+
+    static constexpr auto Schema = std::make_tuple(
+        Json::Member("total_time", &RouteResponse::totalTime),
+        Json::Member("request_id", &RouteResponse::requestId),
+        Json::Member("items", &RouteResponse::items));
+};
+
+template <typename Items>
+RouteResponse(double, int64_t, Items) -> RouteResponse<Items>;
+
+struct WaitItem
+{
+    double time;
+    std::string_view stopName;
+
+    static constexpr auto Schema = std::make_tuple(
+        Json::Member("time", &WaitItem::time),
+        Json::Member("stop_name", &WaitItem::stopName),
+        Json::Constant("type", "Wait"));
+};
+
+struct BusItem
+{
+    double time;
+    int64_t spanCount;
+    std::string_view bus;
+
+    static constexpr auto Schema = std::make_tuple(
+        Json::Member("time", &BusItem::time),
+        Json::Member("span_count", &BusItem::spanCount),
+        Json::Member("bus", &BusItem::bus),
+        Json::Constant("type", "Bus"));
+};
+
+// Passes rendered markup on to a JSON string being written.
+class SvgStringSink : public Svg::Sink
+{
+    Json::JsonWriter& writer_;
+
+public:
+    explicit SvgStringSink(Json::JsonWriter& writer) :
+        writer_(writer)
+    {}
+
+    void Write(std::string_view markup) override
+    {
+        writer_.StringPiece(markup);
+    }
+};
+
+// Renders a map straight into the response, escaped on the way.
+class SvgString
+{
+    const Svg::Document& document_;
+
+public:
+    explicit SvgString(const Svg::Document& document) :
+        document_(document)
+    {}
+
+    void printInJson(Json::JsonWriter& writer) const
+    {
+        SvgStringSink sink(writer);
+
+        writer.BeginString();
+        document_.Render(sink);
+        writer.EndString();
+    }
+};
+
+// Figures drawn over a map that was escaped beforehand: base is that map as
+// a JSON string, the overlay goes in right before its closing tag.
+class SvgOverlayString
+{
+    std::string_view base_;
+    const Svg::Document& overlay_;
+
+public:
+    SvgOverlayString(std::string_view base, const Svg::Document& overlay) :
+        base_(base),
+        overlay_(overlay)
+    {}
+
+    void printInJson(Json::JsonWriter& writer) const
+    {
+        auto tail = Svg::Document::CLOSING_TAG.size() + 1;
+        SvgStringSink sink(writer);
+
+        writer.BeginValue();
+        writer.Raw(base_.substr(0, base_.size() - tail));
+        overlay_.RenderFigures(sink);
+        writer.Raw(base_.substr(base_.size() - tail));
+    }
+};
+
+template <typename Map>
+struct MapResponse
+{
+    int64_t requestId;
+    Map map;
+
+    static constexpr auto Schema = std::make_tuple(
+        Json::Member("request_id", &MapResponse::requestId),
+        Json::Member("map", &MapResponse::map));
+};
+
+template <typename Map>
+MapResponse(int64_t, Map) -> MapResponse<Map>;
+
+struct SettingsResponse
+{
+    int64_t requestId;
+
+    static constexpr auto Schema = std::make_tuple(
+        Json::Member("request_id", &SettingsResponse::requestId));
+};
+
+struct ErrorResponse
+{
+    int64_t requestId;
+    std::string_view errorMessage;
+
+    static constexpr auto Schema = std::make_tuple(
+        Json::Member("request_id", &ErrorResponse::requestId),
+        Json::Member("error_message", &ErrorResponse::errorMessage));
+};
+
+#endif // RESPONSES_H
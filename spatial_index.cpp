@@ -0,0 +1,132 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+using namespace std;
+
+namespace Spatial {
+
+Box& Box::Extend(const Box& other)
+{
+    minX = min(minX, other.minX);
+    minY = min(minY, other.minY);
+    maxX = max(maxX, other.maxX);
+    maxY = max(maxY, other.maxY);
+
+    return *this;
+}
+
+Cell Cell::Of(double x, double y, double cellSize)
+{
+    return { int64_t(floor(x / cellSize)), int64_t(floor(y / cellSize)) };
+}
+
+size_t CellHash::operator()(const Cell& cell) const
+{
+    return hash<int64_t>()(cell.column) * 1000003 ^ hash<int64_t>()(cell.row);
+}
+
+bool PlacementGrid::Place(const Box& box)
+{
+    auto first = Cell::Of(box.minX, box.minY, cellSize_);
+    auto last = Cell::Of(box.maxX, box.maxY, cellSize_);
+
+    for(auto row = first.row; row <= last.row; row++)
+        for(auto column = first.column; column <= last.column; column++)
+            if(auto cell = cells_.find({ column, row }); cell != cells_.end())
+                for(const auto& other : cell->second)
+                    if(other.Intersects(box))
+                        return false;
+
+    for(auto row = first.row; row <= last.row; row++)
+        for(auto column = first.column; column <= last.column; column++)
+            cells_[{ column, row }].push_back(box);
+
+    return true;
+}
+
+GridIndex::GridIndex(vector<Box> boxes) :
+    boxes_(move(boxes))
+{
+    if(boxes_.empty())
+    {
+        cellStart_.assign(2, 0);
+        return;
+    }
+
+    extent_ = boxes_.front();
+    for(const auto& box : boxes_)
+        extent_.Extend(box);
+
+    // About one item per cell.
+    size_t side = max<size_t>(1, size_t(sqrt(double(boxes_.size()))));
+    columns_ = rows_ = side;
+    cellWidth_ = max((extent_.maxX - extent_.minX) / double(columns_), 1e-9);
+    cellHeight_ = max((extent_.maxY - extent_.minY) / double(rows_), 1e-9);
+
+    // Counting pass, then a fill pass into the flat cell array.
+    cellStart_.assign(columns_ * rows_ + 1, 0);
+    auto forEachCell = [this](const Box& box, auto func) {
+        for(size_t row = Row(box.minY); row <= Row(box.maxY); row++)
+            for(size_t column = Column(box.minX); column <= Column(box.maxX); column++)
+                func(row * columns_ + column);
+    };
+    auto isLarge = [this](const Box& box) {
+        return (Column(box.maxX) - Column(box.minX) + 1) * (Row(box.maxY) - Row(box.minY) + 1) > MAX_CELLS_PER_ITEM;
+    };
+
+    for(size_t item = 0; item < boxes_.size(); item++)
+        if(isLarge(boxes_[item]))
+            large_.push_back(uint32_t(item));
+        else
+            forEachCell(boxes_[item], [this](size_t cell) { cellStart_[cell + 1]++; });
+
+    for(size_t cell = 0; cell < columns_ * rows_; cell++)
+        cellStart_[cell + 1] += cellStart_[cell];
+
+    cellItems_.resize(cellStart_.back());
+    vector<uint32_t> fill(cellStart_.begin(), cellStart_.end() - 1);
+    for(size_t item = 0; item < boxes_.size(); item++)
+        if(!isLarge(boxes_[item]))
+            forEachCell(boxes_[item], [&](size_t cell) { cellItems_[fill[cell]++] = uint32_t(item); });
+}
+
+size_t GridIndex::Column(double x) const
+{
+    double column = floor((x - extent_.minX) / cellWidth_);
+    return size_t(clamp(column, 0.0, double(columns_ - 1)));
+}
+
+size_t GridIndex::Row(double y) const
+{
+    double row = floor((y - extent_.minY) / cellHeight_);
+    return size_t(clamp(row, 0.0, double(rows_ - 1)));
+}
+
+vector<size_t> GridIndex::Query(const Box& area) const
+{
+    vector<size_t> result;
+    if(boxes_.empty() || !area.Intersects(extent_))
+        return result;
+
+    for(size_t row = Row(area.minY); row <= Row(area.maxY); row++)
+        for(size_t column = Column(area.minX); column <= Column(area.maxX); column++)
+        {
+            size_t cell = row * columns_ + column;
+            for(size_t i = cellStart_[cell]; i < cellStart_[cell + 1]; i++)
+                if(boxes_[cellItems_[i]].Intersects(area))
+                    result.push_back(cellItems_[i]);
+        }
+    for(auto item : large_)
+        if(boxes_[item].Intersects(area))
+            result.push_back(item);
+
+    sort(result.begin(), result.end());
+    result.erase(unique(result.begin(), result.end()), result.end());
+
+    return result;
+}
+
+}
@@ -0,0 +1,98 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace Spatial {
+
+struct Box
+{
+    double minX = 0.0;
+    double minY = 0.0;
+    double maxX = 0.0;
+    double maxY = 0.0;
+
+    bool Intersects(const Box& other) const
+    {
+        return minX <= other.maxX && other.minX <= maxX &&
+               minY <= other.maxY && other.minY <= maxY;
+    }
+
+    Box Expanded(double margin) const
+    {
+        return { minX - margin, minY - margin, maxX + margin, maxY + margin };
+    }
+
+    Box& Extend(const Box& other);
+};
+
+// A square of an unbounded grid with the given cell size.
+struct Cell
+{
+    int64_t column = 0;
+    int64_t row = 0;
+
+    static Cell Of(double x, double y, double cellSize);
+
+    bool operator==(const Cell& other) const
+    {
+        return column == other.column && row == other.row;
+    }
+};
+
+struct CellHash
+{
+    size_t operator()(const Cell& cell) const;
+};
+
+// Boxes placed one at a time, each only if it overlaps none of those placed
+// before. Keeps labels from being drawn over each other.
+class PlacementGrid
+{
+    double cellSize_;
+    std::unordered_map<Cell, std::vector<Box>, CellHash> cells_;
+
+public:
+    explicit PlacementGrid(double cellSize) :
+        cellSize_(cellSize)
+    {}
+
+    // Whether the box was free and is now taken.
+    bool Place(const Box& box);
+};
+
+// Uniform grid over the boxes of a fixed set of items. Every cell lists the
+// items overlapping it; items spanning many cells, such as bus lines across
+// the whole city, are kept aside and checked on every query instead of
+// being copied into each cell.
+class GridIndex
+{
+    static const size_t MAX_CELLS_PER_ITEM = 16;
+
+    std::vector<Box> boxes_;
+    Box extent_;
+    size_t columns_ = 1, rows_ = 1;
+    double cellWidth_ = 1.0, cellHeight_ = 1.0;
+
+    // Items of cell c are cellItems_[cellStart_[c] .. cellStart_[c + 1]).
+    std::vector<uint32_t> cellStart_;
+    std::vector<uint32_t> cellItems_;
+    std::vector<uint32_t> large_;
+
+    size_t Column(double x) const;
+    size_t Row(double y) const;
+
+public:
+    GridIndex() = default;
+    explicit GridIndex(std::vector<Box> boxes);
+
+    // Items whose box intersects area, in ascending order.
+    std::vector<size_t> Query(const Box& area) const;
+};
+
+}
+
+#endif // SPATIAL_INDEX_H
@@ -0,0 +1,360 @@
+#include "svg.h"
+
+#include <unordered_set>
+#include <deque>
+#include <shared_mutex>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <mutex>
+
+using namespace std;
+
+namespace Svg {
+
+namespace {
+
+class AtomTable
+{
+    // A deque never moves its elements, so views into them stay valid.
+    deque<string> storage_;
+    unordered_set<string_view> strings_;
+    shared_mutex mutex_;
+
+public:
+    string_view Intern(string_view value)
+    {
+        {
+            shared_lock lock(mutex_);
+            if(auto it = strings_.find(value); it != strings_.end())
+                return *it;
+        }
+
+        unique_lock lock(mutex_);
+        if(auto it = strings_.find(value); it != strings_.end())
+            return *it;
+        return *strings_.insert(storage_.emplace_back(value)).first;
+    }
+};
+
+AtomTable& Atoms()
+{
+    static AtomTable table;
+    return table;
+}
+
+}
+
+namespace {
+
+double SegmentDistance(Point point, Point begin, Point end)
+{
+    double dx = end.x - begin.x, dy = end.y - begin.y;
+    double lengthSquared = dx * dx + dy * dy;
+    double t = lengthSquared > 0
+            ? clamp(((point.x - begin.x) * dx + (point.y - begin.y) * dy) / lengthSquared, 0.0, 1.0)
+            : 0.0;
+
+    return hypot(point.x - (begin.x + t * dx), point.y - (begin.y + t * dy));
+}
+
+}
+
+vector<Point> Simplify(const vector<Point>& points, double tolerance)
+{
+    if(points.size() < 3)
+        return points;
+
+    vector<bool> keep(points.size(), false);
+    keep.front() = keep.back() = true;
+
+    // Ranges still to split, instead of recursion: bus lines can be long.
+    vector<pair<size_t, size_t>> ranges = { { 0, points.size() - 1 } };
+    while(!ranges.empty())
+    {
+        auto [first, last] = ranges.back();
+        ranges.pop_back();
+
+        double farthest = 0.0;
+        size_t index = first;
+        for(size_t i = first + 1; i < last; i++)
+            if(double distance = SegmentDistance(points[i], points[first], points[last]); distance > farthest)
+            {
+                farthest = distance;
+                index = i;
+            }
+
+        if(index != first && farthest > tolerance)
+        {
+            keep[index] = true;
+            ranges.push_back({ first, index });
+            ranges.push_back({ index, last });
+        }
+    }
+
+    vector<Point> result;
+    for(size_t i = 0; i < points.size(); i++)
+        if(keep[i])
+            result.push_back(points[i]);
+
+    return result;
+}
+
+Atom::Atom(string_view value) :
+    value_(Atoms().Intern(value))
+{}
+
+void Writer::Number(double val)
+{
+    char buffer[32];
+    auto result = to_chars(begin(buffer), end(buffer), val, chars_format::general, 6);
+    Raw(string_view(buffer, result.ptr - buffer));
+}
+
+void Writer::Number(uint32_t val)
+{
+    char buffer[16];
+    auto result = to_chars(begin(buffer), end(buffer), val);
+    Raw(string_view(buffer, result.ptr - buffer));
+}
+
+void Rgb::Render(Writer& out) const
+{
+    out.Raw(alpha.has_value() ? "rgba(" : "rgb(");
+    out.Number(uint32_t(red));
+    out.Raw(",");
+    out.Number(uint32_t(green));
+    out.Raw(",");
+    out.Number(uint32_t(blue));
+    if(alpha.has_value())
+    {
+        out.Raw(",");
+        out.Number(alpha.value());
+    }
+    out.Raw(")");
+}
+
+string Color::ToString() const
+{
+    string result;
+    StringSink sink(result);
+    Writer writer(sink);
+    Render(writer);
+    writer.Flush();
+
+    return result;
+}
+
+void Color::Render(Writer& out) const
+{
+    if(auto atom = get_if<Atom>(&color_))
+        out.Raw(atom->Get());
+    else if(auto rgb = get_if<Rgb>(&color_))
+        rgb->Render(out);
+    else
+        out.Raw("none");
+}
+
+void Circle::Render(Writer& out) const
+{
+    out.Raw("<circle ");
+    out.Attribute("cx", centerX_);
+    out.Attribute("cy", centerY_);
+    out.Attribute("r", radius_);
+    RenderBase(out);
+    out.Raw("/>");
+}
+
+void Polyline::Render(Writer& out) const
+{
+    if(!breaks_.empty())
+    {
+        // Each run is a moveto followed by implicit linetos.
+        out.Raw("<path d=");
+        out.Quote();
+        auto nextBreak = breaks_.begin();
+        for(size_t i = 0; i < points_.size(); i++)
+        {
+            bool runStart = i == 0 || (nextBreak != breaks_.end() && *nextBreak == i);
+            if(runStart && i != 0)
+                ++nextBreak;
+            out.Raw(runStart ? (i == 0 ? "M" : " M") : " ");
+            out.Number(points_[i].x);
+            out.Raw(",");
+            out.Number(points_[i].y);
+        }
+        out.Quote();
+        out.Raw(" ");
+        RenderBase(out);
+        out.Raw("/>");
+        return;
+    }
+
+    out.Raw("<polyline points=");
+    out.Quote();
+    for(const auto& point : points_)
+    {
+        out.Number(point.x);
+        out.Raw(",");
+        out.Number(point.y);
+        out.Raw(" ");
+    }
+    out.Quote();
+    out.Raw(" ");
+    RenderBase(out);
+    out.Raw("/>");
+}
+
+void Text::Render(Writer& out) const
+{
+    if(underlayerClass_.Empty())
+    {
+        out.Raw("<text ");
+        RenderText(out, true);
+        return;
+    }
+
+    // The copy inherits everything from the Use, the text from the group.
+    out.Raw("<g ");
+    out.Attribute("class", class_);
+    out.Raw("><use xlink:href=\"#");
+    out.Raw(id_.Get());
+    out.Raw("\" ");
+    out.Attribute("class", underlayerClass_);
+    out.Raw("/><text ");
+    out.Attribute("id", id_);
+    RenderText(out, false);
+    out.Raw("</g>");
+}
+
+void Text::RenderText(Writer& out, bool styled) const
+{
+    out.Attribute("x", point_.x);
+    out.Attribute("y", point_.y);
+    if(offset_.has_value())
+    {
+        out.Attribute("dx", offset_->x);
+        out.Attribute("dy", offset_->y);
+    }
+    if(fontSize_.has_value())
+        out.Attribute("font-size", fontSize_.value());
+    if(styled)
+        RenderBase(out);
+    if(!fontFamily_.Empty())
+        out.Attribute("font-family", fontFamily_);
+    if(!fontWeight_.Empty())
+        out.Attribute("font-weight", fontWeight_);
+    out.Raw(">");
+    out.Raw(data_.Get());
+    out.Raw("</text>");
+}
+
+void Use::Render(Writer& out) const
+{
+    out.Raw("<use ");
+    // SVG 1.1 renderers only know the xlink form.
+    out.Attribute("xlink:href", href_);
+    out.Attribute("x", point_.x);
+    out.Attribute("y", point_.y);
+    if(!class_.Empty())
+        out.Attribute("class", class_);
+    out.Raw("/>");
+}
+
+void Rect::Render(Writer& out) const
+{
+    out.Raw("<rect ");
+    out.Attribute("x", origin_.x);
+    out.Attribute("y", origin_.y);
+    out.Attribute("width", size_.x);
+    out.Attribute("height", size_.y);
+    RenderBase(out);
+    if(fillOpacity_.has_value())
+        out.Attribute("fill-opacity", fillOpacity_.value());
+    out.Raw("/>");
+}
+
+void Document::RenderFigures(Writer& out, const Figures& figures) const
+{
+    for(const auto& figure : figures)
+        visit([&out](const auto& item) { item.Render(out); }, figure);
+}
+
+void Document::RenderHeader(Writer& writer) const
+{
+    writer.Raw("<?xml version=\"1.0\" encoding=\"UTF-8\" ?>"
+               "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\"");
+    if(!definitions_.empty())
+        writer.Raw(" xmlns:xlink=\"http://www.w3.org/1999/xlink\"");
+    if(viewBox_.has_value())
+    {
+        const auto& [origin, size] = viewBox_.value();
+        writer.Raw(" viewBox=\"");
+        writer.Number(origin.x);
+        writer.Raw(" ");
+        writer.Number(origin.y);
+        writer.Raw(" ");
+        writer.Number(size.x);
+        writer.Raw(" ");
+        writer.Number(size.y);
+        writer.Raw("\"");
+    }
+    writer.Raw(">");
+
+    if(!style_.empty())
+    {
+        writer.Raw("<style>");
+        writer.Raw(style_);
+        writer.Raw("</style>");
+    }
+    if(!definitions_.empty())
+    {
+        writer.Raw("<defs>");
+        RenderFigures(writer, definitions_);
+        writer.Raw("</defs>");
+    }
+}
+
+void Document::Render(Sink& out) const
+{
+    Writer writer(out);
+    RenderHeader(writer);
+    RenderFigures(writer, figures_);
+
+    writer.Raw(CLOSING_TAG);
+    writer.Flush();
+}
+
+void Document::RenderHeader(Sink& out) const
+{
+    Writer writer(out);
+    RenderHeader(writer);
+    writer.Flush();
+}
+
+void Document::RenderFigures(Sink& out) const
+{
+    Writer writer(out);
+    RenderFigures(writer, figures_);
+    writer.Flush();
+}
+
+void Document::Render(string& out) const
+{
+    StringSink sink(out);
+    Render(sink);
+}
+
+void Document::Render(ostream& out) const
+{
+    struct StreamSink : Sink
+    {
+        ostream& out;
+        explicit StreamSink(ostream& target) : out(target) {}
+        void Write(string_view markup) override { out.write(markup.data(), markup.size()); }
+    } sink(out);
+
+    Render(sink);
+}
+
+}
@@ -4,12 +4,11 @@
 #include <iostream>
 #include <optional>
 #include <variant>
-#include <iomanip>
-#include <memory>
 #include <vector>
 #include <string>
-
-#include <cmath>
+#include <string_view>
+#include <cstdint>
+#include <utility>
 
 #include "json.h"
 
@@ -22,6 +21,129 @@ struct Point
     double y = 0.0;
 };
 
+// Douglas-Peucker: drops every point that lies within tolerance of the line
+// through the points kept around it. The ends are always kept.
+std::vector<Point> Simplify(const std::vector<Point>& points, double tolerance);
+
+// Handle to an interned string. Attribute values such as line caps, font
+// names and colors, as well as label texts, repeat across thousands of
+// figures: each distinct value is stored once for the lifetime of the
+// program. Atoms may be created from several threads at once.
+class Atom
+{
+    std::string_view value_;
+
+public:
+    Atom() = default;
+    explicit Atom(std::string_view value);
+
+    std::string_view Get() const
+    {
+        return value_;
+    }
+
+    bool Empty() const
+    {
+        return value_.data() == nullptr;
+    }
+};
+
+// Receives rendered markup chunk by chunk.
+class Sink
+{
+public:
+    virtual ~Sink() = default;
+    virtual void Write(std::string_view markup) = 0;
+};
+
+// Appends markup to a string.
+class StringSink : public Sink
+{
+    std::string& out_;
+
+public:
+    explicit StringSink(std::string& out) :
+        out_(out)
+    {}
+
+    void Write(std::string_view markup) override
+    {
+        out_.append(markup);
+    }
+};
+
+// Collects markup into chunks, so that the sink sees a few large writes
+// rather than one call per attribute.
+class Writer
+{
+    static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+    Sink& sink_;
+    std::string chunk_;
+
+public:
+    explicit Writer(Sink& sink) :
+        sink_(sink)
+    {
+        chunk_.reserve(CHUNK_SIZE);
+    }
+
+    void Raw(std::string_view bytes)
+    {
+        chunk_.append(bytes);
+        if(chunk_.size() >= CHUNK_SIZE)
+            Flush();
+    }
+
+    void Quote()
+    {
+        Raw("\"");
+    }
+
+    void Flush()
+    {
+        sink_.Write(chunk_);
+        chunk_.clear();
+    }
+
+    // Same digits as an iostream with default flags: %g, 6 significant.
+    void Number(double val);
+    void Number(uint32_t val);
+
+    template <typename T>
+    void Attribute(std::string_view name, const T& val)
+    {
+        Raw(name);
+        Raw("=");
+        Quote();
+        Value(val);
+        Quote();
+        Raw(" ");
+    }
+
+private:
+    void Value(double val)
+    {
+        Number(val);
+    }
+
+    void Value(uint32_t val)
+    {
+        Number(val);
+    }
+
+    void Value(Atom val)
+    {
+        Raw(val.Get());
+    }
+
+    template <typename T>
+    auto Value(const T& val) -> decltype(val.Render(*this))
+    {
+        val.Render(*this);
+    }
+};
+
 struct Rgb
 {
     ushort red;
@@ -42,33 +164,17 @@ struct Rgb
         alpha(a)
     {}
 
-    friend std::ostream& operator<<(std::ostream& stream, const Rgb& val)
-    {
-        if(val.alpha.has_value())
-        {
-            stream << "rgba(" << val.red << ','
-                   << val.green << ','
-                   << val.blue << ','
-                   << val.alpha.value() << ')';
-        } else
-        {
-            stream << "rgb(" << val.red << ','
-                   << val.green << ','
-                   << val.blue << ')';
-        }
-
-        return stream;
-    }
+    void Render(Writer& out) const;
 };
 
 class Color
 {
-    std::optional<std::variant<std::string, Rgb>> color_;
+    std::variant<std::monostate, Atom, Rgb> color_;
 
 public:
     Color() = default;
 
-    Color(const std::vector<Json::Node>& rgb)
+    Color(const Json::Array& rgb)
     {
         if(rgb.size() == 4)
         {
@@ -85,44 +191,28 @@ public:
         }
     }
 
-    Color(std::string color) :
-        color_(std::move(color))
+    Color(std::string_view color) :
+        color_(Atom(color))
     {}
 
     Color(Rgb color) :
         color_(std::move(color))
     {}
 
-    friend std::ostream& operator<<(std::ostream& stream, const Color& val)
-    {
-        const auto getVal = [&stream](const auto& var) { stream << var; };
-        if(val.color_.has_value())
-        {
-            std::visit(getVal, val.color_.value());
-        } else
-            stream << "none";
-
-        return stream;
-    }
+    void Render(Writer& out) const;
+    std::string ToString() const;
 };
 
 static const Color NoneColor;
 
-class FigureInterface
-{
-public:
-    virtual ~FigureInterface() {};
-    virtual void print(std::ostream&) = 0;
-    virtual void printRaw(std::ostream&) = 0;
-};
-
 template <typename Derived>
-class Figure : public FigureInterface
+class Figure
 {
 protected:
     Color fillColor_, strokeColor_;
     double strokeWidth_;
-    std::optional<std::string> strokeLineCap_, strokeLineJoin_;
+    Atom strokeLineCap_, strokeLineJoin_;
+    Atom id_, class_;
 
     Figure() :
         fillColor_(NoneColor),
@@ -130,40 +220,27 @@ protected:
         strokeWidth_(1.0)
     {}
 
-    void printBase(std::ostream& stream) const
+    // A figure with a class is styled by the document stylesheet alone.
+    void RenderBase(Writer& out) const
     {
-        stream << "fill=\"" << fillColor_ << "\" "
-               << "stroke=\"" << strokeColor_ << "\" "
-               << "stroke-width=\"" << strokeWidth_ << "\" ";
-        if(strokeLineCap_.has_value())
-            stream << "stroke-linecap=\"" << strokeLineCap_.value() << "\" ";
-        if(strokeLineJoin_.has_value())
-            stream << "stroke-linejoin=\"" << strokeLineJoin_.value() << "\" ";
-    }
+        if(!id_.Empty())
+            out.Attribute("id", id_);
+        if(!class_.Empty())
+        {
+            out.Attribute("class", class_);
+            return;
+        }
 
-    void printBaseRaw(std::ostream& stream) const
-    {
-        stream << "fill=\\\"" << fillColor_ << "\\\" "
-               << "stroke=\\\"" << strokeColor_ << "\\\" "
-               << "stroke-width=\\\"" << strokeWidth_ << "\\\" ";
-        if(strokeLineCap_.has_value())
-            stream << "stroke-linecap=\\\"" << strokeLineCap_.value() << "\\\" ";
-        if(strokeLineJoin_.has_value())
-            stream << "stroke-linejoin=\\\"" << strokeLineJoin_.value() << "\\\" ";
+        out.Attribute("fill", fillColor_);
+        out.Attribute("stroke", strokeColor_);
+        out.Attribute("stroke-width", strokeWidth_);
+        if(!strokeLineCap_.Empty())
+            out.Attribute("stroke-linecap", strokeLineCap_);
+        if(!strokeLineJoin_.Empty())
+            out.Attribute("stroke-linejoin", strokeLineJoin_);
     }
 
 public:
-    virtual void print(std::ostream& stream) override
-    {
-         static_cast<Derived*>(this)->print(stream);
-    }
-
-    virtual void printRaw(std::ostream& stream) override
-    {
-         static_cast<Derived*>(this)->printRaw(stream);
-    }
-
-
     Derived& SetFillColor(const Color& color)
     {
         fillColor_ = color;
@@ -171,9 +248,9 @@ public:
         return *static_cast<Derived*>(this);
     }
 
-    Derived& SetFillColor(std::string color)
+    Derived& SetFillColor(std::string_view color)
     {
-        fillColor_ = Color(move(color));
+        fillColor_ = Color(color);
 
         return *static_cast<Derived*>(this);
     }
@@ -192,20 +269,35 @@ public:
         return *static_cast<Derived*>(this);
     }
 
-    Derived& SetStrokeLineCap(const std::string& lineCap)
+    Derived& SetStrokeLineCap(std::string_view lineCap)
+    {
+        strokeLineCap_ = Atom(lineCap);
+
+        return *static_cast<Derived*>(this);
+    }
+
+    Derived& SetStrokeLineJoin(std::string_view lineJoin)
+    {
+        strokeLineJoin_ = Atom(lineJoin);
+
+        return *static_cast<Derived*>(this);
+    }
+
+    Derived& SetId(std::string_view id)
     {
-        strokeLineCap_ = lineCap;
+        id_ = Atom(id);
 
         return *static_cast<Derived*>(this);
     }
 
-    Derived& SetStrokeLineJoin(const std::string lineJoin)
+    Derived& SetClass(std::string_view className)
     {
-        strokeLineJoin_ = lineJoin;
+        class_ = Atom(className);
 
         return *static_cast<Derived*>(this);
     }
 };
+
 class Circle: public Figure<Circle>
 {
 protected:
@@ -233,31 +325,15 @@ public:
         return *this;
     }
 
-    void print(std::ostream &stream) override
-    {
-        stream << "<circle ";
-        stream << "cx=\"" << centerX_ << "\" "
-               << "cy=\"" << centerY_ << "\" "
-               << "r=\"" << radius_ << "\" ";
-        printBase(stream);
-        stream << "/>";
-    }
-    void printRaw(std::ostream &stream) override
-    {
-        stream << "<circle ";
-        stream << "cx=\\\"" << centerX_ << "\\\" "
-               << "cy=\\\"" << centerY_ << "\\\" "
-               << "r=\\\"" << radius_ << "\\\" ";
-        printBaseRaw(stream);
-        stream << "/>";
-    }
-
+    void Render(Writer& out) const;
 };
 
 class Polyline: public Figure<Polyline>
 {
 protected:
     std::vector<Point> points_;
+    // Positions in points_ where a run not joined to the one before starts.
+    std::vector<size_t> breaks_;
 
 public:
     Polyline() :
@@ -271,39 +347,38 @@ public:
         return *this;
     }
 
-    void print(std::ostream &stream) override
+    // Starts a new run with the next point, not joined to the last one. A
+    // polyline with several runs is written as a single path, so places
+    // where the runs overlap are still painted once.
+    Polyline& Break()
     {
-        stream << "<polyline points=\"";
-        for(const auto& point : points_)
-            stream << point.x << "," << point.y << " ";
-        stream << "\" ";
-        printBase(stream);
-        stream << "/>";
-    }
+        if(!points_.empty() && (breaks_.empty() || breaks_.back() != points_.size()))
+            breaks_.push_back(points_.size());
 
-    void printRaw(std::ostream &stream) override
-    {
-        stream << "<polyline points=\\\"";
-        for(const auto& point : points_)
-            stream << point.x << "," << point.y << " ";
-        stream << "\\\" ";
-        printBaseRaw(stream);
-        stream << "/>";
+        return *this;
     }
+
+    bool Empty() const { return points_.empty(); }
+
+    void Render(Writer& out) const;
 };
 
 class Text: public Figure<Text>
 {
 protected:
-    Point point_, offset_;
-    uint32_t fontSize_;
-    std::optional<std::string> fontFamily_, fontWeight_;
-    std::string data_;
+    Point point_;
+    std::optional<Point> offset_;
+    std::optional<uint32_t> fontSize_;
+    Atom fontFamily_, fontWeight_;
+    Atom data_;
+    Atom underlayerClass_;
+
+    // Everything after the tag name; the id and style only if styled.
+    void RenderText(Writer& out, bool styled) const;
 
 public:
     Text() :
-        Figure(),
-        fontSize_(1)
+        Figure()
     {}
 
     Text& SetPoint(Point point)
@@ -327,94 +402,175 @@ public:
         return *this;
     }
 
-    Text& SetFontFamily(const std::string& family)
+    Text& SetFontFamily(std::string_view family)
     {
-        fontFamily_ = family;
+        fontFamily_ = Atom(family);
 
         return *this;
     }
 
-    Text& SetData(const std::string& data)
+    Text& SetData(std::string_view data)
     {
-        data_ = data;
+        data_ = Atom(data);
 
         return *this;
     }
 
-    Text& SetFontWeight(const std::string& weight)
+    Text& SetFontWeight(std::string_view weight)
     {
-        fontWeight_ = weight;
+        fontWeight_ = Atom(weight);
 
         return *this;
     }
 
-    void print(std::ostream &stream) override
+    // Draws the text over a copy of itself styled by the given class, with
+    // the data written once: the text and a Use of it are grouped, the
+    // group takes the class of the text and the Use the one given here.
+    // Needs an id and a class, and the xlink namespace Use needs.
+    Text& SetUnderlayerClass(std::string_view className)
+    {
+        underlayerClass_ = Atom(className);
+
+        return *this;
+    }
+
+    void Render(Writer& out) const;
+};
+
+// A copy of a figure defined in the document, moved to a point. It keeps
+// the style of the original unless given a class.
+class Use: public Figure<Use>
+{
+protected:
+    Atom href_;
+    Point point_;
+
+public:
+    Use() :
+        Figure()
+    {}
+
+    Use& SetHref(std::string_view href)
     {
-        stream << "<text ";
-        stream << "x=\"" << point_.x << "\" "
-               << "y=\"" << point_.y << "\" "
-               << "dx=\"" << offset_.x << "\" "
-               << "dy=\"" << offset_.y << "\" "
-               << "font-size=\"" << fontSize_ << "\" ";
+        href_ = Atom(href);
 
-        printBase(stream);
-        if(fontFamily_.has_value())
-            stream << "font-family=\"" << fontFamily_.value() << "\" ";
-        if(fontWeight_.has_value())
-            stream << "font-weight=\"" << fontWeight_.value() << "\" ";
-        stream << ">" << data_ << "</text>";
+        return *this;
     }
 
-    void printRaw(std::ostream &stream) override
+    Use& SetPoint(Point point)
     {
-        stream << "<text ";
-        stream << "x=\\\"" << point_.x << "\\\" "
-               << "y=\\\"" << point_.y << "\\\" "
-               << "dx=\\\"" << offset_.x << "\\\" "
-               << "dy=\\\"" << offset_.y << "\\\" "
-               << "font-size=\\\"" << fontSize_ << "\\\" ";
-        printBaseRaw(stream);
-        if(fontFamily_.has_value())
-            stream << "font-family=\\\"" << fontFamily_.value() << "\\\" ";
-        if(fontWeight_.has_value())
-            stream << "font-weight=\\\"" << fontWeight_.value() << "\\\" ";
-        stream << ">" << data_ << "</text>";
+        point_ = point;
+
+        return *this;
     }
+
+    void Render(Writer& out) const;
 };
 
+class Rect: public Figure<Rect>
+{
+protected:
+    Point origin_, size_;
+    std::optional<double> fillOpacity_;
+
+public:
+    Rect() :
+        Figure()
+    {}
+
+    Rect& SetOrigin(Point origin)
+    {
+        origin_ = origin;
+
+        return *this;
+    }
+
+    Rect& SetSize(Point size)
+    {
+        size_ = size;
+
+        return *this;
+    }
+
+    // Applied on top of any alpha of the fill color.
+    Rect& SetFillOpacity(double opacity)
+    {
+        fillOpacity_ = opacity;
+
+        return *this;
+    }
+
+    void Render(Writer& out) const;
+};
+
+// Figures are kept by value in drawing order and rendered in a single pass
+// without virtual calls.
 class Document
 {
-    std::vector<std::unique_ptr<FigureInterface>> figures_;
+    using Figures = std::vector<std::variant<Circle, Polyline, Text, Rect, Use>>;
+
+    Figures figures_;
+    std::optional<std::pair<Point, Point>> viewBox_;
+    std::string style_;
+    Figures definitions_;
+
+    void RenderHeader(Writer& out) const;
+    void RenderFigures(Writer& out, const Figures& figures) const;
 
 public:
+    static constexpr std::string_view CLOSING_TAG = "</svg>";
+
     Document()
     {}
 
+    // Shows only the area of the given size starting at origin.
+    void SetViewBox(Point origin, Point size)
+    {
+        viewBox_.emplace(origin, size);
+    }
+
     template <typename T>
     void Add(T figure)
     {
-        figures_.push_back(std::make_unique<T>(std::move(figure)));
+        figures_.emplace_back(std::move(figure));
     }
 
-    void Render(std::ostream& out, bool raw = false) const
+    // A stylesheet for the classes the figures refer to.
+    void SetStyle(std::string style)
     {
+        style_ = std::move(style);
+    }
 
-        if(raw)
-        {
-            out << "<?xml version=\\\"1.0\\\" encoding=\\\"UTF-8\\\" ?>"
-                   "<svg xmlns=\\\"http://www.w3.org/2000/svg\\\" version=\\\"1.1\\\">";
-            for(const auto& figure: figures_)
-                figure->printRaw(out);
-        } else
-        {
-            out << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>"
-                   "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">";
-            for(const auto& figure: figures_)
-                figure->print(out);
-        }
+    // A figure that is not drawn itself, only referred to by Use; the
+    // document then declares the xlink namespace Use needs.
+    template <typename T>
+    void Define(T figure)
+    {
+        definitions_.emplace_back(std::move(figure));
+    }
 
-        out << "</svg>";
+    // Moves the figures of another document behind the ones of this one.
+    void Append(Document&& other)
+    {
+        figures_.insert(figures_.end(),
+                        std::make_move_iterator(other.figures_.begin()),
+                        std::make_move_iterator(other.figures_.end()));
     }
+
+    // Copies them instead, leaving the other document as it is.
+    void Append(const Document& other)
+    {
+        figures_.insert(figures_.end(), other.figures_.begin(), other.figures_.end());
+    }
+
+    void Render(Sink& out) const;
+    // Everything before the figures: declaration, opening tag, styles and
+    // definitions.
+    void RenderHeader(Sink& out) const;
+    // Only the figures, to be drawn over another document.
+    void RenderFigures(Sink& out) const;
+    void Render(std::string& out) const;
+    void Render(std::ostream& out) const;
 };
 
 }
@@ -0,0 +1,144 @@
+// Reads CSV text through Csv::Reader with buffers from one byte up, so rows
+// cross chunk boundaries and outgrow the buffer, and compares every field
+// with the rows the text was written from: quoted commas, quotes and line
+// breaks, CRLF line ends, blank lines and a last row without a newline.
+
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../csv_reader.h"
+
+namespace {
+
+  using Rows = std::vector<std::vector<std::string>>;
+
+  const std::vector<size_t> BUFFER_SIZES = { 1, 2, 3, 5, 8, 13, 64, Csv::Reader::DEFAULT_BUFFER_SIZE };
+
+  size_t failures = 0;
+
+  void Fail(const std::string& name, size_t bufferSize, const std::string& message) {
+    if (failures++ < 10)
+      std::cerr << name << ", buffer " << bufferSize << ": " << message << "\n";
+  }
+
+  // header is rows[0]; every row has as many fields as the header.
+  void CheckReader(const std::string& name, const std::string& text, const Rows& rows, size_t bufferSize) {
+    std::istringstream input(text);
+    Csv::Reader reader(input, bufferSize);
+
+    const auto& header = rows[0];
+    for (size_t column = 0; column < header.size(); column++)
+      if (reader.Column(header[column]) != column)
+        Fail(name, bufferSize, "column " + header[column] + " misplaced");
+
+    size_t row = 1;
+    for (; reader.NextRow(); row++) {
+      if (row >= rows.size()) {
+        Fail(name, bufferSize, "extra row " + std::to_string(row));
+        return;
+      }
+      for (size_t column = 0; column <= header.size(); column++) {
+        std::string expected = column < header.size() ? rows[row][column] : "";
+        if (reader.Field(column) != expected)
+          Fail(name, bufferSize, "row " + std::to_string(row) + " column " + std::to_string(column) +
+                                 ": \"" + std::string(reader.Field(column)) + "\" instead of \"" + expected + "\"");
+      }
+    }
+    if (row < rows.size())
+      Fail(name, bufferSize, "read " + std::to_string(row - 1) + " rows of " + std::to_string(rows.size() - 1));
+  }
+
+  void Check(const std::string& name, const std::string& text, const Rows& rows) {
+    for (size_t bufferSize : BUFFER_SIZES)
+      try {
+        CheckReader(name, text, rows, bufferSize);
+      } catch (const std::exception& error) {
+        Fail(name, bufferSize, error.what());
+      }
+  }
+
+  std::string Encode(const std::string& field, bool forceQuotes) {
+    if (!forceQuotes && field.find_first_of(",\"\r\n") == std::string::npos)
+      return field;
+
+    std::string out = "\"";
+    for (char c : field) {
+      if (c == '"')
+        out += '"';
+      out += c;
+    }
+    return out + "\"";
+  }
+
+}
+
+int main() {
+  Check("plain", "id,name,lat\n1,Stop A,43.5\n2,Stop B,43.6\n",
+        { { "id", "name", "lat" }, { "1", "Stop A", "43.5" }, { "2", "Stop B", "43.6" } });
+
+  Check("crlf and no trailing newline", "id,name,lat\r\n1,Stop A,43.5\r\n2,,\r\n3,Stop C,43.7",
+        { { "id", "name", "lat" }, { "1", "Stop A", "43.5" }, { "2", "", "" }, { "3", "Stop C", "43.7" } });
+
+  Check("blank lines", "\n\nid,name,lat\n\n1,A,1\r\n\r\n\n2,B,2\n\n",
+        { { "id", "name", "lat" }, { "1", "A", "1" }, { "2", "B", "2" } });
+
+  Check("quoted", "id,name,lat\n"
+                  "1,\"Stop, with comma\",1\n"
+                  "2,\"Say \"\"hi\"\"\",2\n"
+                  "3,\"two\nlines\",3\n"
+                  "4,\"crlf\r\ninside\",4\r\n"
+                  "5,\"\",\"\"\n",
+        { { "id", "name", "lat" },
+          { "1", "Stop, with comma", "1" },
+          { "2", "Say \"hi\"", "2" },
+          { "3", "two\nlines", "3" },
+          { "4", "crlf\r\ninside", "4" },
+          { "5", "", "" } });
+
+  std::string longName(1000, 'x');
+  Check("row longer than the buffer", "id,name,lat\n1," + longName + ",1\n2,\"" + longName + "\n\",2\n",
+        { { "id", "name", "lat" }, { "1", longName, "1" }, { "2", longName + "\n", "2" } });
+
+  // Random documents from random fields, written back the way a CSV writer
+  // would.
+  const std::string alphabet = "ab ,\"\r\n;\xD0\xB0";
+  std::mt19937 random(7);
+  for (size_t doc = 0; doc < 300; doc++) {
+    Rows rows = { { "id", "name", "lat" } };
+    size_t rowCount = random() % 30;
+    for (size_t i = 0; i < rowCount; i++) {
+      std::vector<std::string> row;
+      for (size_t column = 0; column < 3; column++) {
+        std::string field(random() % 4 == 0 ? random() % 100 : random() % 8, ' ');
+        for (auto& c : field)
+          c = alphabet[random() % alphabet.size()];
+        row.push_back(field);
+      }
+      rows.push_back(row);
+    }
+
+    std::string text;
+    for (size_t i = 0; i < rows.size(); i++) {
+      if (random() % 8 == 0)
+        text += "\n";
+      for (size_t column = 0; column < 3; column++)
+        text += (column ? "," : "") + Encode(rows[i][column], random() % 8 == 0);
+      if (i + 1 < rows.size() || random() % 2)
+        text += random() % 2 ? "\r\n" : "\n";
+    }
+
+    Check("random " + std::to_string(doc), text, rows);
+  }
+
+  if (failures) {
+    std::cerr << failures << " failures\n";
+    return 1;
+  }
+
+  std::cout << "csv_reader: all checks passed\n";
+  return 0;
+}
@@ -0,0 +1,129 @@
+// Checks FindEscape and WriteEscaped against a byte-by-byte reference:
+// every byte value at every position around the 16- and 32-byte chunk
+// boundaries, then random strings at random alignments. The scanners are
+// checked one by one as well, so the SSE2 and scalar tails are covered on
+// a CPU with AVX2.
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../json_escape.cpp"
+
+namespace {
+
+  bool ReferenceNeedsEscape(unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\';
+  }
+
+  size_t ReferenceFind(const std::string& str) {
+    for (size_t i = 0; i < str.size(); i++)
+      if (ReferenceNeedsEscape(str[i]))
+        return i;
+    return str.size();
+  }
+
+  std::string ReferenceEscape(const std::string& str) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c : str) {
+      switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+          if (c < 0x20) {
+            out += "\\u00";
+            out += digits[c >> 4];
+            out += digits[c & 0xF];
+          } else {
+            out += char(c);
+          }
+      }
+    }
+    return out;
+  }
+
+  struct StringOut {
+    std::string str;
+
+    void Append(const char* data, size_t size) {
+      str.append(data, size);
+    }
+  };
+
+  size_t failures = 0;
+
+  void Check(const std::string& str, size_t offset) {
+    // The string is placed at the given offset of a buffer, so chunk loads
+    // start at every alignment.
+    std::string buffer(offset, 'x');
+    buffer += str;
+    const char* data = buffer.data() + offset;
+
+    size_t expected = ReferenceFind(str);
+    struct Scanner {
+      const char* name;
+      size_t found;
+    };
+    std::vector<Scanner> scanners = {
+      { "FindEscape", Json::FindEscape(data, str.size()) },
+      { "scalar", Json::FindEscapeScalar(data, 0, str.size()) },
+    };
+#ifdef JSON_ESCAPE_X86
+    scanners.push_back({ "sse2", Json::FindEscapeSse2(data, str.size()) });
+    if (Json::HasAvx2())
+      scanners.push_back({ "avx2", Json::FindEscapeAvx2(data, str.size()) });
+#endif
+
+    for (const auto& scanner : scanners)
+      if (scanner.found != expected && failures++ < 10)
+        std::cerr << scanner.name << ": found " << scanner.found << ", expected " << expected
+                  << " (size " << str.size() << ", offset " << offset << ")\n";
+
+    StringOut out;
+    Json::WriteEscaped(out, std::string_view(data, str.size()));
+    if (out.str != ReferenceEscape(str) && failures++ < 10)
+      std::cerr << "WriteEscaped differs (size " << str.size() << ", offset " << offset << ")\n";
+  }
+
+}
+
+int main() {
+  // Every byte value at every position of clean strings up to three AVX2
+  // chunks long, which covers each hand-off to a narrower tail.
+  for (size_t size = 1; size <= 97; size++)
+    for (size_t pos = 0; pos < size; pos++)
+      for (int byte = 0; byte < 256; byte++) {
+        std::string str(size, 'a');
+        str[pos] = char(byte);
+        Check(str, 0);
+      }
+
+  // Random strings, mostly clean with bytes near the edges of the escaped
+  // ranges mixed in, at random alignments.
+  const unsigned char interesting[] = { 0x00, 0x01, 0x08, 0x09, 0x0A, 0x1E, 0x1F, 0x20, 0x21, '"',
+                                        '\\', 0x5B, 0x5D, 0x7F, 0x80, 0x9F, 0xA0, 0xD0, 0xFF };
+  std::mt19937 random(2024);
+  for (size_t i = 0; i < 200000; i++) {
+    std::string str(random() % 200, '\0');
+    unsigned density = random() % 64 + 1;
+    for (auto& c : str)
+      c = random() % density == 0 ? char(interesting[random() % sizeof(interesting)])
+                                  : char(0x20 + random() % 0xE0);
+    Check(str, random() % 32);
+  }
+
+  if (failures) {
+    std::cerr << failures << " failures\n";
+    return 1;
+  }
+
+  std::cout << "json_escape: all checks passed\n";
+  return 0;
+}
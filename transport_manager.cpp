@@ -3,71 +3,386 @@
 #include "bus_station.h"
 #include "path_item.h"
 #include "json_serialize.hpp"
+#include "responses.h"
+#include "parallel.h"
+#include "json_escape.h"
 
+#include <algorithm>
+#include <charconv>
 #include <cmath>
 #include <iostream>
+#include <tuple>
+#include <unordered_set>
 #include <variant>
 
 using namespace std;
 
+namespace {
+
+// How much of the underlayer color the base map of a route map is dimmed
+// with, so that it stays visible even when that color is opaque.
+const double ROUTE_DIM_OPACITY = 0.5;
+
+// The document as a quoted and escaped JSON string.
+string RenderPayload(const Svg::Document& map)
+{
+    string payload;
+    Io::StringSink sink(payload);
+    Io::OutputBuffer out(sink, 64 * 1024);
+    Json::JsonWriter writer(out);
+    Json::Write(writer, SvgString(map));
+    out.Flush();
+
+    return payload;
+}
+
+// Markup escaped for a JSON string, quotes left to the caller.
+class EscapedSink : public Svg::Sink
+{
+    string& out_;
+
+public:
+    explicit EscapedSink(string& out) : out_(out) {}
+
+    void Write(string_view markup) override
+    {
+        Json::WriteEscaped(*this, markup);
+    }
+
+    void Append(const char* data, size_t size)
+    {
+        out_.append(data, size);
+    }
+};
+
+string FormatNumber(double val)
+{
+    char buffer[32];
+    auto result = to_chars(begin(buffer), end(buffer), val, chars_format::general, 6);
+    return string(buffer, result.ptr);
+}
+
+// Style settings joined into a key that changes whenever one of them does.
+string KeyPart(double val)
+{
+    char buffer[32];
+    auto result = to_chars(begin(buffer), end(buffer), val);
+    return string(buffer, result.ptr);
+}
+
+string KeyPart(Svg::Point point)
+{
+    return KeyPart(point.x) + ',' + KeyPart(point.y);
+}
+
+string KeyPart(const Svg::Color& color)
+{
+    return color.ToString();
+}
+
+string KeyPart(const vector<Svg::Color>& palette)
+{
+    string key;
+    for(const auto& color: palette)
+        key += color.ToString() + ' ';
+    return key;
+}
+
+string KeyPart(const optional<double>& val)
+{
+    return val.has_value() ? KeyPart(val.value()) : "-";
+}
+
+template <typename... Values>
+string StyleKey(const Values&... values)
+{
+    string key;
+    ((key += KeyPart(values), key += ';'), ...);
+    return key;
+}
+
+// Where a label lands once its offset is applied.
+Svg::Point LabelPoint(Svg::Point anchor, Svg::Point offset)
+{
+    return { anchor.x + offset.x, anchor.y + offset.y };
+}
+
+Spatial::Box PointBox(Svg::Point point)
+{
+    return { point.x, point.y, point.x, point.y };
+}
+
+// Labels are not measured: every glyph is taken as wide as the font is
+// high, which rather keeps a label that is just out of view than drops one
+// that is partly in it.
+Spatial::Box TextBox(Svg::Point anchor, Svg::Point offset, double fontSize,
+                     string_view text, double strokeWidth)
+{
+    auto glyphs = count_if(text.begin(), text.end(), [](char c) { return (c & 0xC0) != 0x80; });
+    double x = anchor.x + offset.x;
+    double y = anchor.y + offset.y;
+
+    return Spatial::Box{ x, y - fontSize, x + fontSize * double(glyphs), y + fontSize / 2 }
+            .Expanded(strokeWidth / 2);
+}
+
+// Whether any part of the segment from a to b lies in the box
+// (Liang-Barsky).
+bool SegmentIntersects(const Spatial::Box& box, Svg::Point a, Svg::Point b)
+{
+    double dx = b.x - a.x, dy = b.y - a.y;
+    double enter = 0.0, leave = 1.0;
+    for(auto [p, q] : { pair{ -dx, a.x - box.minX }, pair{ dx, box.maxX - a.x },
+                        pair{ -dy, a.y - box.minY }, pair{ dy, box.maxY - a.y } })
+    {
+        if(p == 0.0)
+        {
+            if(q < 0.0)
+                return false;
+            continue;
+        }
+        double t = q / p;
+        if(p < 0.0)
+            enter = max(enter, t);
+        else
+            leave = min(leave, t);
+        if(enter > leave)
+            return false;
+    }
+
+    return true;
+}
+
+}
+
 Svg::Point TransportManager::createPoint(double latitude, double longitude) const
 {
-    return {
+    Svg::Point point = {
         (longitude - minLongitude_.value()) * zoomCoef_.value() + renderSettings_.padding,
         (maxLatitude_.value() - latitude) * zoomCoef_.value() + renderSettings_.padding
       };
+
+    if(const auto& scale = renderSettings_.coordinateScale; scale.has_value())
+        point = { round(point.x * scale.value()) / scale.value(),
+                  round(point.y * scale.value()) / scale.value() };
+
+    return point;
+}
+
+Svg::Point TransportManager::stationPoint(StationId station) const
+{
+    return stationPoints_[station];
 }
 
-TransportManager& TransportManager::createInstance(const vector<Json::Node>& base_requests)
+TransportManager& TransportManager::createInstance(const Json::Array& base_requests)
 {
     static TransportManager instance(base_requests);
 
     return instance;
 }
 
-TransportManager::TransportManager(const vector<Json::Node>& base_requests)
+TransportManager& TransportManager::createInstance(Csv::Feed& feed)
 {
-    vector<int> busQueries;
+    static TransportManager instance(feed);
+
+    return instance;
+}
 
-    for(size_t i = 0; i < base_requests.size(); i++)
+namespace {
+
+// A stop request read off the request array; names point into it.
+struct StopRecord
+{
+    string_view name;
+    double latitude;
+    double longitude;
+    vector<pair<string_view, size_t>> distances;
+};
+
+struct RequestChunk
+{
+    vector<StopRecord> stops;
+    vector<size_t> busQueries;
+};
+
+StopRecord MakeStopRecord(const Json::Dict& stop)
+{
+    StopRecord record{
+        stop.at("name").AsString(),
+        stop.at("latitude").AsDouble() / 180.0 * PI,
+        stop.at("longitude").AsDouble() / 180.0 * PI,
+        {}
+    };
+
+    const auto& distances = stop.at("road_distances").AsMap();
+    record.distances.reserve(distances.size());
+    for(const auto& x : distances)
+        record.distances.emplace_back(x.first, x.second.AsInt());
+
+    return record;
+}
+
+}
+
+TransportManager::TransportManager(const Json::Array& base_requests)
+{
+    // Stop records are built and bus stops resolved to ids on chunks of the
+    // request array in parallel; the tables are filled in request order, so
+    // ids come out the same as with a serial pass.
+    auto chunks = Parallel::MapChunks(base_requests.size(), [&base_requests](size_t begin, size_t end) {
+        RequestChunk chunk;
+
+        for(size_t i = begin; i < end; i++)
+        {
+            const auto& map = base_requests[i].AsMap();
+
+            if(map.at("type").AsString() == "Bus")
+                chunk.busQueries.push_back(i);
+            else
+                chunk.stops.push_back(MakeStopRecord(map));
+        }
+
+        return chunk;
+    });
+
+    vector<size_t> busQueries;
+    for(auto& chunk : chunks)
     {
-        const auto & map = base_requests[i].AsMap();
+        for(const auto& stop : chunk.stops)
+        {
+            auto [id, inserted] = addStation(stop.name, stop.latitude, stop.longitude);
+            if(inserted)
+                for(const auto& distance : stop.distances)
+                    stations_.addDistance(id, distance.first, distance.second);
+        }
+        busQueries.insert(busQueries.end(), chunk.busQueries.begin(), chunk.busQueries.end());
+    }
 
-        if(map.at("type").AsString() == "Bus")
-            busQueries.push_back(i);
-        else
+    auto busChunks = Parallel::MapChunks(busQueries.size(), [this, &base_requests, &busQueries](size_t begin, size_t end) {
+        vector<vector<StationId>> stops;
+
+        for(size_t i = begin; i < end; i++)
+            stops.push_back(resolveStops(base_requests[busQueries[i]].AsMap().at("stops").AsArray()));
+
+        return stops;
+    });
+
+    size_t bus = 0;
+    for(auto& chunk : busChunks)
+        for(auto& stops : chunk)
         {
-            double latitude = map.at("latitude").AsDouble() / 180.0 * PI;
-            double longitude = map.at("longitude").AsDouble() / 180.0 * PI;
+            const auto& map = base_requests[busQueries[bus++]].AsMap();
+            addBus(string(map.at("name").AsString()), stops, map.at("is_roundtrip").AsBool());
+        }
 
-            if(!minLatitude_.has_value())
-            {
-                minLatitude_ = latitude;
-                maxLatitude_ = latitude;
-                minLongitude_ = longitude;
-                maxLongitude_ = longitude;
-            } else
-            {
-                minLatitude_ = min(latitude, minLatitude_.value());
-                maxLatitude_ = max(latitude, maxLatitude_.value());
-                minLongitude_ = min(longitude, minLongitude_.value());
-                maxLongitude_ = max(longitude, maxLongitude_.value());
-            }
+    stations_.indexDistances();
+    stations_.indexBuses(buses_);
+    buses_.indexStats(stations_);
+}
+
+TransportManager::TransportManager(Csv::Feed& feed)
+{
+    // Rows are consumed as they are read; only the feed id => table id maps
+    // needed to resolve references between the files are kept.
+    unordered_map<string, StationId> stopsById;
+    string key;
+    auto stopById = [&stopsById, &key](string_view id) {
+        key.assign(id);
+        return stopsById.at(key);
+    };
+
+    {
+        Csv::Reader stops(feed.stops);
+        auto idCol = stops.Column("stop_id");
+        auto nameCol = stops.Column("stop_name");
+        auto latCol = stops.Column("stop_lat");
+        auto lonCol = stops.Column("stop_lon");
+
+        while(stops.NextRow())
+        {
+            auto station = addStation(stops.Field(nameCol),
+                                      Csv::ParseDouble(stops.Field(latCol)) / 180.0 * PI,
+                                      Csv::ParseDouble(stops.Field(lonCol)) / 180.0 * PI);
+            stopsById.emplace(stops.Field(idCol), station.first);
+        }
+    }
+
+    {
+        Csv::Reader distances(feed.roadDistances);
+        auto fromCol = distances.Column("from_stop_id");
+        auto toCol = distances.Column("to_stop_id");
+        auto distanceCol = distances.Column("distance");
+
+        while(distances.NextRow())
+        {
+            auto to = stopById(distances.Field(toCol));
+            stations_.addDistance(stopById(distances.Field(fromCol)), stations_.getName(to),
+                                  Csv::ParseInt(distances.Field(distanceCol)));
+        }
+    }
+
+    struct Route
+    {
+        string name;
+        bool isLooped;
+        vector<pair<int, StationId>> stops;
+    };
+    vector<Route> routes;
+    unordered_map<string, size_t> routesById;
+    {
+        Csv::Reader routesReader(feed.routes);
+        auto idCol = routesReader.Column("route_id");
+        auto nameCol = routesReader.Column("route_short_name");
+        auto loopedCol = routesReader.Column("is_roundtrip");
 
-            addStation(map.at("name").AsString(),
-                       latitude,
-                       longitude,
-                       map.at("road_distances").AsMap());
+        while(routesReader.NextRow())
+        {
+            routesById.emplace(routesReader.Field(idCol), routes.size());
+            routes.push_back({ string(routesReader.Field(nameCol)),
+                               Csv::ParseBool(routesReader.Field(loopedCol)), {} });
         }
     }
 
-    for(auto x : busQueries)
     {
-        const auto & map = base_requests[x].AsMap();
-        const auto & stops = map.at("stops").AsArray();
+        Csv::Reader routeStops(feed.routeStops);
+        auto routeCol = routeStops.Column("route_id");
+        auto sequenceCol = routeStops.Column("stop_sequence");
+        auto stopCol = routeStops.Column("stop_id");
 
-        addBus(map.at("name").AsString(), stops, map.at("is_roundtrip").AsBool());
+        while(routeStops.NextRow())
+        {
+            auto stop = stopById(routeStops.Field(stopCol));
+            key.assign(routeStops.Field(routeCol));
+            routes[routesById.at(key)].stops.emplace_back(Csv::ParseInt(routeStops.Field(sequenceCol)), stop);
+        }
     }
+
+    for(auto& route : routes)
+    {
+        stable_sort(route.stops.begin(), route.stops.end(),
+                    [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+        vector<StationId> stops;
+        stops.reserve(route.stops.size());
+        for(const auto& stop : route.stops)
+            stops.push_back(stop.second);
+
+        addBus(move(route.name), stops, route.isLooped);
+    }
+
+    stations_.indexDistances();
+    stations_.indexBuses(buses_);
+    buses_.indexStats(stations_);
+}
+
+vector<StationId> TransportManager::resolveStops(const Json::Array& stations) const
+{
+    vector<StationId> stops;
+    stops.reserve(stations.size());
+    for(const auto& station : stations)
+        stops.push_back(stations_.at(station.AsString()));
+
+    return stops;
 }
 
 void TransportManager::updateRouter()
@@ -77,40 +392,49 @@ void TransportManager::updateRouter()
     size_t waitTime = routingSettings_.busWait;
     double busVelocity = routingSettings_.busVelocity;
 
-    for(auto & x : stations_)
-        graph_->AddEdge({x.second->getWaitVertex(), x.second->getMainVertex(), PathItem(x.second->getName(), waitTime)});
+    for(auto id : stations_.byName())
+        graph_->AddEdge({BusStations::getWaitVertex(id), BusStations::getMainVertex(id), PathItem(stations_.getName(id), waitTime)});
 
-    for(auto & x : buses_)
+    auto time = [this, busVelocity](StationId from, StationId to) {
+        return stations_.getDistance(from, to).value() / busVelocity;
+    };
+    auto ride = [this](StationId from, StationId to, string_view bus, double time, size_t spans) {
+        graph_->AddEdge({BusStations::getMainVertex(from), BusStations::getWaitVertex(to), PathItem(bus, time, spans)});
+    };
+
+    for(auto bus : buses_.byName())
     {
-        const auto & stations = x.second->getStations();
+        auto name = buses_.getName(bus);
+        auto stops = buses_.getStops(bus);
+        bool looped = buses_.isLooped(bus);
 
-        for(auto first = stations.begin(); first != stations.end(); first++)
+        for(size_t first = 0; first < stops.size(); first++)
         {
             double val = 0;
             size_t spans = 0;
-            for(auto second = first + 1; second != stations.end(); second++)
+            for(size_t second = first + 1; second < stops.size(); second++)
             {
-                val += (*(second - 1))->getDistance(*second).value() / busVelocity;
-                graph_->AddEdge({(*first)->getMainVertex(), (*second)->getWaitVertex(), PathItem(x.second->getName(), val, ++spans)});
+                val += time(stops[second - 1], stops[second]);
+                ride(stops[first], stops[second], name, val, ++spans);
             }
 
-            if(!x.second->isLooped())
-                for(auto second = stations.rbegin() + 1; second != stations.rend(); second++)
+            if(!looped)
+                for(size_t second = stops.size() - 1; second-- > 0;)
                 {
-                    val += (*(second - 1))->getDistance(*second).value() / busVelocity;
-                    graph_->AddEdge({(*first)->getMainVertex(), (*second)->getWaitVertex(), PathItem(x.second->getName(), val, ++spans)});
+                    val += time(stops[second + 1], stops[second]);
+                    ride(stops[first], stops[second], name, val, ++spans);
                 }
         }
 
-        if(!x.second->isLooped())
-            for(auto first = stations.rbegin(); first != stations.rend(); first++)
+        if(!looped)
+            for(size_t first = stops.size(); first-- > 0;)
             {
                 double val = 0;
                 size_t spans = 0;
-                for(auto second = first + 1; second != stations.rend(); second++)
+                for(size_t second = first; second-- > 0;)
                 {
-                    val += (*(second - 1))->getDistance(*second).value() / busVelocity;
-                    graph_->AddEdge({(*first)->getMainVertex(), (*second)->getWaitVertex(), PathItem(x.second->getName(), val, ++spans)});
+                    val += time(stops[second + 1], stops[second]);
+                    ride(stops[first], stops[second], name, val, ++spans);
                 }
             }
     }
@@ -118,24 +442,22 @@ void TransportManager::updateRouter()
     router_ = make_unique<RouterType>(*graph_);
 }
 
-void TransportManager::addBus(string name, vector<Json::Node> stations, bool isLooped)
+void TransportManager::addBus(string name, const Json::Array& stations, bool isLooped)
 {
-    shared_ptr<Bus> bus = make_shared<Bus>(name, isLooped);
+    addBus(move(name), resolveStops(stations), isLooped);
+    stations_.indexBuses(buses_);
+    buses_.indexStats(stations_);
+}
 
-    auto first = stations_.find(stations.front().AsString());
-    first->second->addBus(bus);
-    bus->addStation(first->second);
-    for(auto it = stations.begin() + 1; it != stations.end(); it++) {
-        auto stat = stations_.find(it->AsString());
-        stat->second->addBus(bus);
-        bus->addStation(stat->second);
-        first = stat;
-    }
+void TransportManager::addBus(string name, const vector<StationId>& stops, bool isLooped)
+{
+    invalidateMap();
+    invalidateResponses();
 
-    buses_.insert({ bus->getName(), bus });
+    buses_.add(move(name), stops, isLooped);
 }
 
-TransportManager& TransportManager::setRoutingSettings(const std::map<string, Json::Node> &routingSettings)
+TransportManager& TransportManager::setRoutingSettings(const Json::Dict &routingSettings)
 {
     routingSettings_.busWait = routingSettings.at("bus_wait_time").AsInt();
     routingSettings_.busVelocity = routingSettings.at("bus_velocity").AsDouble() * 1000.0 / 60.0; // km/h => m/s
@@ -145,8 +467,15 @@ TransportManager& TransportManager::setRoutingSettings(const std::map<string, Js
     return *this;
 }
 
-TransportManager& TransportManager::setRenderSettings(const std::map<string, Json::Node> &renderSettings)
+TransportManager& TransportManager::setRenderSettings(const Json::Dict &renderSettings)
 {
+    // Stops are projected again only if the geometry of the map changes;
+    // layers drawn before are kept as long as their style stays the same.
+    auto geometry = [](const RenderSettings& settings) {
+        return make_tuple(settings.width, settings.height, settings.padding, settings.coordinateScale);
+    };
+    auto previousGeometry = geometry(renderSettings_);
+
     renderSettings_.width = renderSettings.at("width").AsDouble();
     renderSettings_.height = renderSettings.at("height").AsDouble();
     renderSettings_.padding = renderSettings.at("padding").AsDouble();
@@ -159,37 +488,79 @@ TransportManager& TransportManager::setRenderSettings(const std::map<string, Jso
     renderSettings_.busLblOffset = { renderSettings.at("bus_label_offset").AsArray()[0].AsDouble(),
                                      renderSettings.at("bus_label_offset").AsArray()[1].AsDouble() };
 
+    renderSettings_.colorPalette.clear();
     for(const auto& color : renderSettings.at("color_palette").AsArray())
         if(color.IsArray())
             renderSettings_.colorPalette.emplace_back(color.AsArray());
         else
-            renderSettings_.colorPalette.emplace_back(color.AsString());
+            renderSettings_.colorPalette.emplace_back(string(color.AsString()));
 
     renderSettings_.underlayerWidth = renderSettings.at("underlayer_width").AsDouble();
 
-    auto underlayedColor = renderSettings.at("underlayer_color");
+    const auto& underlayedColor = renderSettings.at("underlayer_color");
     if(underlayedColor.IsArray())
         renderSettings_.underlayerColor = { underlayedColor.AsArray() };
     else
-        renderSettings_.underlayerColor = { underlayedColor.AsString() };
+        renderSettings_.underlayerColor = { string(underlayedColor.AsString()) };
 
+    renderSettings_.renderOrder.clear();
     for(const auto& layer: renderSettings.at("layers").AsArray())
-        renderSettings_.renderOrder.push_back(layer.AsString());
+        renderSettings_.renderOrder.emplace_back(layer.AsString());
+
+    // Optional, for smaller maps: coordinates rounded to a number of
+    // decimals, bus lines simplified within a tolerance in pixels, styles
+    // shared through CSS classes, and non-looped buses traced one way only.
+    renderSettings_.coordinateScale.reset();
+    if(auto it = renderSettings.find("coordinate_precision"); it != renderSettings.end())
+        renderSettings_.coordinateScale = pow(10.0, it->second.AsInt());
+
+    renderSettings_.simplifyTolerance.reset();
+    if(auto it = renderSettings.find("simplify_tolerance"); it != renderSettings.end())
+        renderSettings_.simplifyTolerance = it->second.AsDouble();
+
+    // Also optional, for very large networks: a map with less detail, stops
+    // clustered in cells of the given size in pixels.
+    renderSettings_.lodCellSize.reset();
+    if(auto it = renderSettings.find("lod_cell_size"); it != renderSettings.end())
+        renderSettings_.lodCellSize = it->second.AsDouble();
+
+    renderSettings_.compact = false;
+    if(auto it = renderSettings.find("compact_svg"); it != renderSettings.end())
+        renderSettings_.compact = it->second.AsBool();
+
+    renderSettings_.singlePassLines = false;
+    if(auto it = renderSettings.find("single_pass_lines"); it != renderSettings.end())
+        renderSettings_.singlePassLines = it->second.AsBool();
 
     updateZoomCoef();
 
+    if(geometry(renderSettings_) != previousGeometry)
+        invalidateMap();
+    else
+        invalidateMapOutput();
+
     return *this;
 }
 
-void TransportManager::addStation(string name, double latitude, double longitude, const map<string, Json::Node>& distances)
+pair<StationId, bool> TransportManager::addStation(string_view name, double latitude, double longitude)
 {
-    auto station = make_shared<BusStation>(move(name), move(latitude), move(longitude));
-    for(auto & x: distances)
-        station->addDistance(x.first, x.second.AsInt());
+    invalidateMap();
 
-    auto newStation = stations_.insert({station->getName(), station}).first->second;
-    newStation->setMainVertex((stations_.size() - 1) * 2);
-    newStation->setWaitVertex((stations_.size() - 1) * 2 + 1);
+    if(!minLatitude_.has_value())
+    {
+        minLatitude_ = latitude;
+        maxLatitude_ = latitude;
+        minLongitude_ = longitude;
+        maxLongitude_ = longitude;
+    } else
+    {
+        minLatitude_ = min(latitude, minLatitude_.value());
+        maxLatitude_ = max(latitude, maxLatitude_.value());
+        minLongitude_ = min(longitude, minLongitude_.value());
+        maxLongitude_ = max(longitude, maxLongitude_.value());
+    }
+
+    return stations_.add(name, latitude, longitude);
 }
 
 void TransportManager::updateZoomCoef()
@@ -216,177 +587,781 @@ void TransportManager::updateZoomCoef()
     }
 }
 
+Svg::Document TransportManager::makeMapDocument() const
+{
+    Svg::Document map;
+    if(!renderSettings_.compact)
+        return map;
+
+    // Shared styles once, as classes. A label is drawn over a Use of itself
+    // in class h for its underlayer: SVG 1.1 has no paint-order.
+    const auto& settings = renderSettings_;
+    string underlayer = settings.underlayerColor.ToString();
+
+    string style = ".l{fill:none;stroke-width:" + FormatNumber(settings.lineWidth) +
+            ";stroke-linecap:round;stroke-linejoin:round}"
+            ".b{font-size:" + to_string(settings.busLblFontSize) + "px;font-family:Verdana;"
+            "font-weight:bold}"
+            ".s{font-size:" + to_string(settings.stopLblFontSize) + "px;font-family:Verdana;"
+            "fill:black}"
+            ".h{fill:" + underlayer + ";stroke:" + underlayer +
+            ";stroke-width:" + FormatNumber(settings.underlayerWidth) +
+            ";stroke-linecap:round;stroke-linejoin:round}"
+            ".p{fill:white;stroke:none}";
+    for(size_t i = 0; i < settings.colorPalette.size(); i++)
+    {
+        string color = settings.colorPalette[i].ToString();
+        style += ".l" + to_string(i) + "{stroke:" + color + "}"
+                 ".f" + to_string(i) + "{fill:" + color + "}";
+    }
+    map.SetStyle(move(style));
+
+    map.Define(Svg::Circle{}.SetRadius(settings.stopRadius).SetId("p").SetClass("p"));
+
+    return map;
+}
+
+void TransportManager::prepareMapItems()
+{
+    mapBuses_ = buses_.byName();
+    mapStations_ = stations_.byName();
+
+    if(stationPoints_.empty())
+    {
+        stationPoints_.reserve(stations_.size());
+        for(StationId id = 0; id < stations_.size(); id++)
+            stationPoints_.push_back(createPoint(stations_.getLatitude(id), stations_.getLongitude(id)));
+    }
+
+    mapLayers_.clear();
+    mapItemCount_ = 0;
+    for(const auto& name: renderSettings_.renderOrder)
+    {
+        const auto& layer = renderFuncs_.at(name);
+        size_t size = layer.items == MapLayer::BUSES ? mapBuses_.size() : mapStations_.size();
+        mapLayers_.push_back({ mapItemCount_, mapItemCount_ + size, &layer });
+        mapItemCount_ += size;
+    }
+}
+
+void TransportManager::renderMapItem(Svg::Document& map, size_t item, const MapDetail* detail,
+                                     const Spatial::Box* clip) const
+{
+    auto range = upper_bound(mapLayers_.begin(), mapLayers_.end(), item,
+                             [](size_t item, const MapLayerRange& range) { return item < range.end; });
+    (this->*range->layer->render)(map, item - range->begin, detail, clip);
+}
+
+const TransportManager::MapDetail* TransportManager::getMapDetail(int zoom)
+{
+    if(!renderSettings_.lodCellSize.has_value())
+        return nullptr;
+
+    auto detail = mapDetails_.find(zoom);
+    if(detail == mapDetails_.end())
+        detail = mapDetails_.emplace(zoom, makeMapDetail(ldexp(renderSettings_.lodCellSize.value(), -zoom))).first;
+
+    return &detail->second;
+}
+
+TransportManager::MapDetail TransportManager::makeMapDetail(double cellSize) const
+{
+    const auto& settings = renderSettings_;
+
+    MapDetail detail;
+    detail.anchors.resize(stations_.size());
+    detail.markers.assign(stations_.size(), false);
+    detail.stopLabels.assign(stations_.size(), false);
+
+    // The stop that stands for every stop of its cell, by id.
+    vector<StationId> leads(stations_.size());
+    unordered_map<Spatial::Cell, StationId, Spatial::CellHash> cells;
+    for(auto station: mapStations_)
+    {
+        auto point = stationPoint(station);
+        auto [cell, inserted] = cells.emplace(Spatial::Cell::Of(point.x, point.y, cellSize), station);
+        leads[station] = cell->second;
+        detail.anchors[station] = stationPoints_[cell->second];
+        detail.markers[station] = inserted;
+    }
+
+    // Segments between two lead stops, smaller id first.
+    unordered_set<uint64_t> drawn;
+    for(auto bus: mapBuses_)
+    {
+        detail.lineStart.push_back(detail.lines.size());
+
+        vector<StationId> path;
+        auto pass = [&](StationId id) {
+            if(path.empty() || path.back() != leads[id])
+                path.push_back(leads[id]);
+        };
+        auto stops = buses_.getStops(bus);
+        for(auto stop: stops)
+            pass(stop);
+        if(!buses_.isLooped(bus) && !settings.singlePassLines)
+            for(size_t i = stops.size() - 1; i-- > 0;)
+                pass(stops[i]);
+
+        vector<Svg::Point> line;
+        for(size_t i = 1; i < path.size(); i++)
+        {
+            auto [from, to] = minmax(path[i - 1], path[i]);
+            if(drawn.insert(uint64_t(from) << 32 | uint64_t(to)).second)
+            {
+                if(line.empty())
+                    line.push_back(stationPoints_[path[i - 1]]);
+                line.push_back(stationPoints_[path[i]]);
+            } else if(!line.empty())
+            {
+                detail.lines.push_back(move(line));
+                line.clear();
+            }
+        }
+        if(!line.empty())
+            detail.lines.push_back(move(line));
+    }
+    detail.lineStart.push_back(detail.lines.size());
+
+    double fontSize = double(max(settings.busLblFontSize, settings.stopLblFontSize));
+    Spatial::PlacementGrid labels(max(cellSize, fontSize));
+    for(size_t pos = 0; pos < mapBuses_.size(); pos++)
+    {
+        auto bus = mapBuses_[pos];
+        auto stops = buses_.getStops(bus);
+        auto place = [&](StationId station) {
+            return labels.Place(TextBox(detail.anchors[station], settings.busLblOffset,
+                                        double(settings.busLblFontSize), buses_.getName(bus),
+                                        settings.underlayerWidth));
+        };
+
+        detail.busLabels.push_back(place(stops.front()));
+        detail.busLabels.push_back(!buses_.isLooped(bus) && stops.back() != stops.front() &&
+                                   place(stops.back()));
+    }
+    for(auto station: mapStations_)
+        if(detail.markers[station])
+            detail.stopLabels[station] =
+                    labels.Place(TextBox(stationPoint(station), settings.stopLblOffset,
+                                         double(settings.stopLblFontSize), stations_.getName(station),
+                                         settings.underlayerWidth));
+
+    return detail;
+}
+
+void TransportManager::updateMapFragments()
+{
+    // The items of all stale layers are numbered one after another, so the
+    // layers are drawn together: a chunk may span several of them.
+    struct StaleLayer
+    {
+        const MapLayer* layer;
+        size_t begin, end;
+        MapFragment* fragment;
+        string styleKey;
+    };
+    vector<StaleLayer> stale;
+    size_t count = 0;
+    for(const auto& range: mapLayers_)
+    {
+        auto styleKey = (this->*range.layer->styleKey)();
+        auto& fragment = mapFragments_[range.layer];
+        if(fragment.styleKey == styleKey ||
+           any_of(stale.begin(), stale.end(), [&](const StaleLayer& layer) { return layer.layer == range.layer; }))
+            continue;
+
+        size_t size = range.end - range.begin;
+        stale.push_back({ range.layer, count, count + size, &fragment, move(styleKey) });
+        count += size;
+    }
+    if(stale.empty())
+        return;
+
+    // Chunks come back in drawing order, each with its part of every
+    // layer it touches.
+    const auto* detail = getMapDetail(0);
+    auto chunks = Parallel::MapChunks(count, [&](size_t begin, size_t end) {
+        vector<pair<size_t, Svg::Document>> parts;
+        auto layer = upper_bound(stale.begin(), stale.end(), begin,
+                                 [](size_t item, const StaleLayer& layer) { return item < layer.end; });
+        for(; layer != stale.end() && layer->begin < end; ++layer)
+        {
+            Svg::Document part;
+            for(size_t item = max(begin, layer->begin); item < min(end, layer->end); item++)
+                (this->*layer->layer->render)(part, item - layer->begin, detail, nullptr);
+            parts.emplace_back(size_t(layer - stale.begin()), move(part));
+        }
+        return parts;
+    });
+
+    for(auto& layer: stale)
+        layer.fragment->figures = Svg::Document();
+    for(auto& parts: chunks)
+        for(auto& [layer, part]: parts)
+            stale[layer].fragment->figures.Append(move(part));
+
+    auto payloads = Parallel::MapChunks(stale.size(), [&stale](size_t begin, size_t end) {
+        vector<string> payloads(end - begin);
+        for(size_t i = begin; i < end; i++)
+        {
+            EscapedSink sink(payloads[i - begin]);
+            stale[i].fragment->figures.RenderFigures(sink);
+        }
+        return payloads;
+    }, 1);
+
+    size_t i = 0;
+    for(auto& chunk: payloads)
+        for(auto& payload: chunk)
+        {
+            stale[i].fragment->payload = move(payload);
+            stale[i].fragment->styleKey = move(stale[i].styleKey);
+            i++;
+        }
+}
+
 const Svg::Document &TransportManager::getMap()
 {
     if(map_.has_value())
         return map_.value();
 
-    map_.emplace();
+    prepareMapItems();
 
-    for(const auto& layer: renderSettings_.renderOrder)
-        (this->*renderFuncs_.at(layer))();
+    updateMapFragments();
+    map_.emplace(makeMapDocument());
+    for(const auto& range: mapLayers_)
+        map_->Append(mapFragments_.at(range.layer).figures);
 
     return map_.value();
 }
 
-void TransportManager::renderBusLines()
+string_view TransportManager::getMapPayload()
 {
-    auto colorIt = renderSettings_.colorPalette.begin();
-    for(const auto& bus: buses_)
-    {
-        if(colorIt == renderSettings_.colorPalette.end())
-            colorIt = renderSettings_.colorPalette.begin();
-        Svg::Polyline line;
-        line.SetStrokeColor(*colorIt++)
+    if(mapPayload_.has_value())
+        return mapPayload_.value();
+
+    prepareMapItems();
+    updateMapFragments();
+
+    string payload = "\"";
+    EscapedSink sink(payload);
+    makeMapDocument().RenderHeader(sink);
+    for(const auto& range: mapLayers_)
+        payload += mapFragments_.at(range.layer).payload;
+    sink.Write(Svg::Document::CLOSING_TAG);
+    payload += '"';
+
+    return mapPayload_.emplace(move(payload));
+}
+
+string_view TransportManager::getMapSvg()
+{
+    if(mapSvg_.has_value())
+        return mapSvg_.value();
+
+    string svg;
+    getMap().Render(svg);
+
+    return mapSvg_.emplace(move(svg));
+}
+
+const Spatial::GridIndex& TransportManager::getMapIndex()
+{
+    if(mapIndex_.has_value())
+        return mapIndex_.value();
+
+    prepareMapItems();
+
+    vector<Spatial::Box> boxes;
+    boxes.reserve(mapItemCount_);
+    for(const auto& range: mapLayers_)
+        for(size_t pos = 0; pos < range.end - range.begin; pos++)
+            boxes.push_back((this->*range.layer->bounds)(pos));
+
+    return mapIndex_.emplace(move(boxes));
+}
+
+void TransportManager::invalidateMap()
+{
+    stationPoints_.clear();
+    mapFragments_.clear();
+    invalidateMapOutput();
+}
+
+void TransportManager::invalidateMapOutput()
+{
+    mapDetails_.clear();
+    map_.reset();
+    mapPayload_.reset();
+    mapSvg_.reset();
+    mapIndex_.reset();
+    tilePayloads_.clear();
+}
+
+void TransportManager::invalidateResponses()
+{
+    // Stop responses list the buses through the stop, so any new bus can
+    // change them; queries are answered directly until precomputed again.
+    responseArena_.clear();
+    busResponses_.clear();
+    stopResponses_.clear();
+}
+
+Spatial::Box TransportManager::busLineBounds(size_t pos) const
+{
+    auto stops = buses_.getStops(mapBuses_[pos]);
+    auto box = PointBox(stationPoint(stops.front()));
+    for(auto stop: stops)
+        box.Extend(PointBox(stationPoint(stop)));
+
+    // With less detail, lines run through the first stop of each cell.
+    return box.Expanded(renderSettings_.lineWidth / 2 + renderSettings_.lodCellSize.value_or(0.0));
+}
+
+Spatial::Box TransportManager::busLabelsBounds(size_t pos) const
+{
+    auto bus = mapBuses_[pos];
+    auto labelBox = [&](StationId station) {
+        return TextBox(stationPoint(station),
+                       renderSettings_.busLblOffset, double(renderSettings_.busLblFontSize),
+                       buses_.getName(bus), renderSettings_.underlayerWidth);
+    };
+
+    return labelBox(buses_.getStops(bus).front()).Extend(labelBox(buses_.getStops(bus).back()))
+            .Expanded(renderSettings_.lodCellSize.value_or(0.0));
+}
+
+Spatial::Box TransportManager::stationPointBounds(size_t pos) const
+{
+    return PointBox(stationPoint(mapStations_[pos]))
+            .Expanded(renderSettings_.stopRadius);
+}
+
+Spatial::Box TransportManager::stationLabelsBounds(size_t pos) const
+{
+    auto station = mapStations_[pos];
+    return TextBox(stationPoint(station),
+                   renderSettings_.stopLblOffset, double(renderSettings_.stopLblFontSize),
+                   stations_.getName(station), renderSettings_.underlayerWidth);
+}
+
+string TransportManager::busLineStyle() const
+{
+    const auto& settings = renderSettings_;
+    if(settings.compact)
+        return StyleKey(true, double(settings.colorPalette.size()),
+                        settings.simplifyTolerance, settings.singlePassLines) + detailStyle();
+
+    return StyleKey(false, settings.colorPalette, settings.lineWidth,
+                    settings.simplifyTolerance, settings.singlePassLines) + detailStyle();
+}
+
+string TransportManager::busLabelsStyle() const
+{
+    const auto& settings = renderSettings_;
+    if(settings.compact)
+        return StyleKey(true, double(settings.colorPalette.size()), settings.busLblOffset) + detailStyle();
+
+    return StyleKey(false, settings.colorPalette, settings.busLblOffset, double(settings.busLblFontSize),
+                    settings.underlayerColor, settings.underlayerWidth) + detailStyle();
+}
+
+string TransportManager::stationPointStyle() const
+{
+    if(renderSettings_.compact)
+        return StyleKey(true) + detailStyle();
+
+    return StyleKey(false, renderSettings_.stopRadius) + detailStyle();
+}
+
+string TransportManager::stationLabelsStyle() const
+{
+    const auto& settings = renderSettings_;
+    if(settings.compact)
+        return StyleKey(true, settings.stopLblOffset) + detailStyle();
+
+    return StyleKey(false, settings.stopLblOffset, double(settings.stopLblFontSize),
+                    settings.underlayerColor, settings.underlayerWidth) + detailStyle();
+}
+
+// Which stops and labels are left out depends on all of these.
+string TransportManager::detailStyle() const
+{
+    const auto& settings = renderSettings_;
+    if(!settings.lodCellSize.has_value())
+        return {};
+
+    return StyleKey(settings.lodCellSize, settings.singlePassLines,
+                    settings.busLblOffset, double(settings.busLblFontSize),
+                    settings.stopLblOffset, double(settings.stopLblFontSize), settings.underlayerWidth);
+}
+
+Svg::Polyline TransportManager::makeBusLine(size_t pos, const vector<Svg::Point>& points,
+                                            const Spatial::Box* clip) const
+{
+    const auto& palette = renderSettings_.colorPalette;
+
+    Svg::Polyline line;
+    if(renderSettings_.compact)
+        line.SetClass("l l" + to_string(pos % palette.size()));
+    else
+        line.SetStrokeColor(palette[pos % palette.size()])
             .SetStrokeWidth(renderSettings_.lineWidth)
             .SetStrokeLineCap("round")
             .SetStrokeLineJoin("round");
-        for(const auto& station: bus.second->getStations())
-        {
-            auto latitude = station->getLatitude();
-            auto longitude = station->getLongitude();
 
-            line.AddPoint(createPoint(latitude, longitude));
+    vector<Svg::Point> simplified;
+    if(renderSettings_.simplifyTolerance.has_value())
+        simplified = Svg::Simplify(points, renderSettings_.simplifyTolerance.value());
+    const auto& path = renderSettings_.simplifyTolerance.has_value() ? simplified : points;
 
-        }
-        if(!bus.second->isLooped())
-            for(auto station = bus.second->getStations().rbegin() + 1; station != bus.second->getStations().rend(); station++)
-            {
-                auto latitude = (*station)->getLatitude();
-                auto longitude = (*station)->getLongitude();
+    if(!clip)
+    {
+        for(const auto& point: path)
+            line.AddPoint(point);
+        return line;
+    }
 
-                line.AddPoint(createPoint(latitude, longitude));
+    // Only the segments that reach into the clip box are kept; a run of
+    // them is broken off wherever a segment in between is left out.
+    if(path.size() == 1 && SegmentIntersects(*clip, path[0], path[0]))
+        line.AddPoint(path[0]);
+    bool joined = false;
+    for(size_t i = 1; i < path.size(); i++)
+    {
+        if(!SegmentIntersects(*clip, path[i - 1], path[i]))
+        {
+            joined = false;
+            continue;
+        }
+        if(!joined)
+            line.Break().AddPoint(path[i - 1]);
+        line.AddPoint(path[i]);
+        joined = true;
+    }
 
-            }
-        map_->Add(move(line));
-    }
-}
-
-void TransportManager::renderBusLabels()
-{
-    auto colorIt = renderSettings_.colorPalette.begin();
-    auto addText = [this](const auto& bus, const auto& station,
-                          const auto& color) {
-        map_->Add(Svg::Text{}.SetPoint(createPoint(
-                                           station->getLatitude(),
-                                           station->getLongitude())
-                                       )
-                  .SetData(bus.second->getName())
-                  .SetOffset(renderSettings_.busLblOffset)
-                  .SetFontSize(renderSettings_.busLblFontSize)
-                  .SetFontFamily("Verdana")
-                  .SetFontWeight("bold")
-                  .SetFillColor(renderSettings_.underlayerColor)
-                  .SetStrokeColor(renderSettings_.underlayerColor)
-                  .SetStrokeWidth(renderSettings_.underlayerWidth)
-                  .SetStrokeLineCap("round")
-                  .SetStrokeLineJoin("round"));
-
-        map_->Add(Svg::Text{}.SetPoint(createPoint(
-                                           station->getLatitude(),
-                                           station->getLongitude())
-                                       )
-                  .SetData(bus.second->getName())
-                  .SetOffset(renderSettings_.busLblOffset)
-                  .SetFontSize(renderSettings_.busLblFontSize)
-                  .SetFontFamily("Verdana")
-                  .SetFontWeight("bold")
-                  .SetFillColor(color));
+    return line;
+}
 
-    };
+void TransportManager::addBusLabel(Svg::Document& map, BusId bus, Svg::Point point,
+                                   size_t pos, bool last, string_view idPrefix) const
+{
+    const auto& palette = renderSettings_.colorPalette;
 
-    for(const auto& bus: buses_)
+    if(renderSettings_.compact)
     {
-        if(colorIt == renderSettings_.colorPalette.end())
-            colorIt = renderSettings_.colorPalette.begin();
-        const auto& stations = bus.second->getStations();
+        map.Add(Svg::Text{}.SetPoint(LabelPoint(point, renderSettings_.busLblOffset))
+                .SetData(buses_.getName(bus))
+                .SetId(string(idPrefix) + (last ? 'e' : 'b') + to_string(bus))
+                .SetClass("b f" + to_string(pos % palette.size()))
+                .SetUnderlayerClass("h"));
+        return;
+    }
+
+    map.Add(Svg::Text{}.SetPoint(point)
+            .SetData(buses_.getName(bus))
+            .SetOffset(renderSettings_.busLblOffset)
+            .SetFontSize(renderSettings_.busLblFontSize)
+            .SetFontFamily("Verdana")
+            .SetFontWeight("bold")
+            .SetFillColor(renderSettings_.underlayerColor)
+            .SetStrokeColor(renderSettings_.underlayerColor)
+            .SetStrokeWidth(renderSettings_.underlayerWidth)
+            .SetStrokeLineCap("round")
+            .SetStrokeLineJoin("round"));
 
-        addText(bus, stations.front(), *colorIt);
+    map.Add(Svg::Text{}.SetPoint(point)
+            .SetData(buses_.getName(bus))
+            .SetOffset(renderSettings_.busLblOffset)
+            .SetFontSize(renderSettings_.busLblFontSize)
+            .SetFontFamily("Verdana")
+            .SetFontWeight("bold")
+            .SetFillColor(palette[pos % palette.size()]));
+}
 
-        if(!bus.second->isLooped() &&
-           stations.back()->getName() != stations.front()->getName())
-            addText(bus, stations.back(), *colorIt);
+void TransportManager::addStationPoint(Svg::Document& map, StationId station) const
+{
+    Svg::Circle stationCircle;
 
-        ++colorIt;
+    if(renderSettings_.compact)
+    {
+        map.Add(Svg::Use{}.SetHref("#p").SetPoint(stationPoint(station)));
+        return;
     }
+
+    stationCircle.SetCenter(stationPoint(station))
+    .SetRadius(renderSettings_.stopRadius)
+    .SetFillColor("white");
+
+    map.Add(move(stationCircle));
 }
 
-void TransportManager::renderStationPoints()
+void TransportManager::addStationLabel(Svg::Document& map, StationId station,
+                                       string_view idPrefix) const
 {
-    for(const auto& station: stations_)
+    Svg::Text text, textShadow;
+
+    if(renderSettings_.compact)
     {
-        Svg::Circle stationCircle;
+        map.Add(text.SetPoint(LabelPoint(stationPoint(station), renderSettings_.stopLblOffset))
+                .SetData(stations_.getName(station))
+                .SetId(string(idPrefix) + 's' + to_string(station))
+                .SetClass("s")
+                .SetUnderlayerClass("h"));
+        return;
+    }
+
+    text.SetPoint(stationPoint(station))
+        .SetOffset(renderSettings_.stopLblOffset)
+        .SetFontSize(renderSettings_.stopLblFontSize)
+        .SetFontFamily("Verdana")
+        .SetData(stations_.getName(station));
+
+    textShadow = text;
+
+    text.SetFillColor("black");
 
-        auto latitude = station.second->getLatitude();
-        auto longitude = station.second->getLongitude();
+    textShadow.SetFillColor(renderSettings_.underlayerColor)
+              .SetStrokeColor(renderSettings_.underlayerColor)
+              .SetStrokeWidth(renderSettings_.underlayerWidth)
+              .SetStrokeLineCap("round")
+              .SetStrokeLineJoin("round");
 
-        stationCircle.SetCenter(createPoint(latitude, longitude))
-        .SetRadius(renderSettings_.stopRadius)
-        .SetFillColor("white");
+    map.Add(move(textShadow));
+    map.Add(move(text));
+}
+
+bool TransportManager::isTerminal(BusId bus, StationId station) const
+{
+    auto stops = buses_.getStops(bus);
 
-        map_->Add(move(stationCircle));
+    return stops.front() == station ||
+           (!buses_.isLooped(bus) && stops.back() == station);
+}
+
+void TransportManager::renderBusLine(Svg::Document& map, size_t pos, const MapDetail* detail,
+                                     const Spatial::Box* clip) const
+{
+    auto add = [&](const vector<Svg::Point>& points) {
+        if(auto line = makeBusLine(pos, points, clip); !line.Empty())
+            map.Add(move(line));
+    };
+
+    if(detail)
+    {
+        for(size_t line = detail->lineStart[pos]; line < detail->lineStart[pos + 1]; line++)
+            add(detail->lines[line]);
+        return;
     }
+
+    auto bus = mapBuses_[pos];
+    auto stops = buses_.getStops(bus);
+
+    vector<Svg::Point> points;
+    for(auto stop: stops)
+        points.push_back(stationPoint(stop));
+    if(!buses_.isLooped(bus) && !renderSettings_.singlePassLines)
+        for(size_t i = stops.size() - 1; i-- > 0;)
+            points.push_back(stationPoint(stops[i]));
+    add(points);
 }
 
-void TransportManager::renderStationLabels()
+void TransportManager::renderBusLabels(Svg::Document& map, size_t pos, const MapDetail* detail,
+                                       const Spatial::Box*) const
 {
-    for(const auto& station: stations_)
+    auto bus = mapBuses_[pos];
+    auto stops = buses_.getStops(bus);
+
+    if(detail)
     {
-        Svg::Text text, textShadow;
+        if(detail->busLabels[2 * pos])
+            addBusLabel(map, bus, detail->anchors[stops.front()], pos, false);
+        if(detail->busLabels[2 * pos + 1])
+            addBusLabel(map, bus, detail->anchors[stops.back()], pos, true);
+        return;
+    }
 
-        auto latitude = station.second->getLatitude();
-        auto longitude = station.second->getLongitude();
+    addBusLabel(map, bus, stationPoint(stops.front()), pos, false);
 
-        text.SetPoint(createPoint(latitude, longitude))
-            .SetOffset(renderSettings_.stopLblOffset)
-            .SetFontSize(renderSettings_.stopLblFontSize)
-            .SetFontFamily("Verdana")
-            .SetData(station.second->getName());
+    if(!buses_.isLooped(bus) && stops.back() != stops.front())
+        addBusLabel(map, bus, stationPoint(stops.back()), pos, true);
+}
 
-        textShadow = text;
+void TransportManager::renderStationPoint(Svg::Document& map, size_t pos, const MapDetail* detail,
+                                          const Spatial::Box*) const
+{
+    auto station = mapStations_[pos];
+    if(!detail || detail->markers[station])
+        addStationPoint(map, station);
+}
 
-        text.SetFillColor("black");
+void TransportManager::renderStationLabels(Svg::Document& map, size_t pos, const MapDetail* detail,
+                                           const Spatial::Box*) const
+{
+    auto station = mapStations_[pos];
+    if(!detail || detail->stopLabels[station])
+        addStationLabel(map, station);
+}
+
+TransportManager::RouteRide TransportManager::makeRouteRide(
+            BusId bus,
+            StationId from,
+            StationId to,
+            size_t spanCount
+        ) const
+{
+    RouteRide ride;
+    ride.bus = bus;
+    ride.pos = size_t(lower_bound(mapBuses_.begin(), mapBuses_.end(), buses_.getName(bus),
+                                  [this](BusId lhs, string_view name) { return buses_.getName(lhs) < name; })
+                      - mapBuses_.begin());
+
+    // Stops in riding order: there and back again unless the bus is looped.
+    auto stops = buses_.getStops(bus);
+    size_t count = stops.size();
+    size_t length = buses_.isLooped(bus) ? count : 2 * count - 1;
+    auto stop = [&](size_t i) {
+        return i < count ? stops[i] : stops[2 * count - 2 - i];
+    };
+
+    for(size_t begin = 0; begin + spanCount < length; begin++)
+        if(stop(begin) == from && stop(begin + spanCount) == to)
+        {
+            for(size_t i = begin; i <= begin + spanCount; i++)
+                ride.stops.push_back(stop(i));
+            break;
+        }
 
-        textShadow.SetFillColor(renderSettings_.underlayerColor)
-                  .SetStrokeColor(renderSettings_.underlayerColor)
-                  .SetStrokeWidth(renderSettings_.underlayerWidth)
-                  .SetStrokeLineCap("round")
-                  .SetStrokeLineJoin("round");
+    return ride;
+}
 
-        map_->Add(move(textShadow));
-        map_->Add(move(text));
+void TransportManager::renderRouteBusLines(Svg::Document& map, const vector<RouteRide>& rides) const
+{
+    for(const auto& ride: rides)
+    {
+        vector<Svg::Point> points;
+        for(auto station: ride.stops)
+            points.push_back(stationPoint(station));
+        map.Add(makeBusLine(ride.pos, points, nullptr));
     }
 }
 
+void TransportManager::renderRouteBusLabels(Svg::Document& map, const vector<RouteRide>& rides) const
+{
+    for(size_t i = 0; i < rides.size(); i++)
+        for(auto station: { rides[i].stops.front(), rides[i].stops.back() })
+            if(isTerminal(rides[i].bus, station))
+                addBusLabel(map, rides[i].bus, stationPoint(station), rides[i].pos,
+                            station != buses_.getStops(rides[i].bus).front(), "r" + to_string(i));
+}
+
+void TransportManager::renderRouteStationPoints(Svg::Document& map, const vector<RouteRide>& rides) const
+{
+    // A transfer stop ends one ride and starts the next; drawn once.
+    for(size_t i = 0; i < rides.size(); i++)
+        for(size_t j = 0; j < rides[i].stops.size(); j++)
+            if(j != 0 || i == 0 || rides[i].stops[j] != rides[i - 1].stops.back())
+                addStationPoint(map, rides[i].stops[j]);
+}
+
+void TransportManager::renderRouteStationLabels(Svg::Document& map, const vector<RouteRide>& rides) const
+{
+    for(size_t i = 0; i < rides.size(); i++)
+        addStationLabel(map, rides[i].stops.front(), "r" + to_string(i));
+    if(!rides.empty())
+        addStationLabel(map, rides.back().stops.back(), "r" + to_string(rides.size()));
+}
+
+TransportManager& TransportManager::precomputeResponses(optional<int> precision)
+{
+    static const string_view REQUEST_ID_MARKER = "\"request_id\":0";
+
+    invalidateResponses();
+
+    Io::StringSink sink(responseArena_);
+    Io::OutputBuffer out(sink, 4096);
+    Json::JsonWriter writer(out);
+    writer.SetPrecision(precision);
+    Json::JsonArray<Json::JsonBase> arr(writer);
+
+    // Each response is rendered with request id 0 and split right after the
+    // "request_id" key. Names are escaped inside strings, so the unescaped
+    // marker can only be the key itself.
+    auto render = [&](auto& responses, uint32_t id, auto print) {
+        size_t offset = responseArena_.size();
+        print();
+        out.Flush();
+
+        size_t marker = responseArena_.find(REQUEST_ID_MARKER, offset);
+        size_t headSize = marker + REQUEST_ID_MARKER.size() - 1 - offset;
+        responses[id] = { offset, headSize, responseArena_.size() - offset - headSize - 1 };
+    };
+
+    busResponses_.resize(buses_.size());
+    for(auto bus : buses_.byName())
+        render(busResponses_, bus, [&] { buses_.printInJson(bus, 0, arr); });
+    stopResponses_.resize(stations_.size());
+    for(auto station : stations_.byName())
+        render(stopResponses_, station, [&] { stations_.printInJson(station, 0, buses_, arr); });
+
+    return *this;
+}
+
+bool TransportManager::spliceResponse(
+            const vector<ResponseFragment>& responses,
+            optional<uint32_t> id,
+            const Json::Dict& query,
+            Json::JsonArray<Json::JsonBase>& arr
+        ) const
+{
+    if(!id.has_value() || id.value() >= responses.size())
+        return false;
+
+    const auto& fragment = responses[id.value()];
+    string_view head(responseArena_.data() + fragment.offset, fragment.headSize);
+    string_view tail(head.data() + fragment.headSize + 1, fragment.tailSize);
+    arr.Splice(head, query.at("id").AsInt(), tail);
+
+    return true;
+}
+
 bool TransportManager::performStopQuery(
-            const std::map<string, Json::Node> &query,
+            const Json::Dict &query,
             Json::JsonArray<Json::JsonBase> &arr
         )
 {
-    if(auto it = stations_.find(query.at("name").AsString()); it != stations_.end())
-        return it->second->printInJson(query.at("id").AsInt(), arr), true;
+    auto station = stations_.find(query.at("name").AsString());
+    if(!stopResponses_.empty())
+        return spliceResponse(stopResponses_, station, query, arr);
+
+    if(station.has_value())
+        return stations_.printInJson(station.value(), query.at("id").AsInt(), buses_, arr), true;
     else
         return false;
 }
 
 bool TransportManager::performBusQuery(
-            const std::map<string, Json::Node> &query,
+            const Json::Dict &query,
             Json::JsonArray<Json::JsonBase> &arr
         )
 {
-    if(auto it = buses_.find(query.at("name").AsString()); it != buses_.end())
-        return it->second->printInJson(query.at("id").AsInt(), arr), true;
+    auto bus = buses_.find(query.at("name").AsString());
+    if(!busResponses_.empty())
+        return spliceResponse(busResponses_, bus, query, arr);
+
+    if(bus.has_value())
+        return buses_.printInJson(bus.value(), query.at("id").AsInt(), arr), true;
     else
         return false;
 }
 
 bool TransportManager::performRouteQuery(
-            const std::map<string, Json::Node> &query,
+            const Json::Dict &query,
             Json::JsonArray<Json::JsonBase> &arr
         )
 {
-    auto from = stations_.at(query.at("from").AsString())->getWaitVertex();
-    auto to = stations_.at(query.at("to").AsString())->getWaitVertex();
+    auto from = BusStations::getWaitVertex(stations_.at(query.at("from").AsString()));
+    auto to = BusStations::getWaitVertex(stations_.at(query.at("to").AsString()));
 
     if(!router_)
         return false;
@@ -396,31 +1371,150 @@ bool TransportManager::performRouteQuery(
     if(!info.has_value())
         return false;
 
-    auto& stationsArr = arr.BeginObject()
-        .Key("total_time").Double(info->weight.getTime())
-        .Key("request_id").Integer(query.at("id").AsInt())
-        .Key("items").BeginArray();
+    arr.Value(RouteResponse{
+        info->weight.getTime(),
+        int64_t(query.at("id").AsInt()),
+        Json::Generated(info->edge_count, [&](size_t i) -> const PathItem& {
+            return graph_->GetEdge(router_->GetRouteEdge(info->id, i)).weight;
+        })
+    });
+
+    router_->ReleaseRoute(info->id);
 
+    return true;
+}
+
+bool TransportManager::performMapQuery(
+            const Json::Dict &query,
+            Json::JsonArray<Json::JsonBase>& arr
+        )
+{
+    arr.Value(MapResponse{ query.at("id").AsInt(), Json::Verbatim(getMapPayload()) });
+
+    return true;
+}
+
+bool TransportManager::performMapTileQuery(
+            const Json::Dict &query,
+            Json::JsonArray<Json::JsonBase>& arr
+        )
+{
+    // Tiles of a finer zoom level get more detail; an area is drawn with
+    // the detail of the whole map.
+    Spatial::Box area;
+    string key;
+    int zoom = 0;
+    if(auto bbox = query.find("bbox"); bbox != query.end())
+    {
+        const auto& coords = bbox->second.AsArray();
+        if(coords.size() != 4)
+            return false;
+        area = { coords[0].AsDouble(), coords[1].AsDouble(), coords[2].AsDouble(), coords[3].AsDouble() };
+        if(area.minX > area.maxX || area.minY > area.maxY)
+            return false;
+        key = "bbox";
+        for(const auto& coord : coords)
+        {
+            char buffer[32];
+            auto result = to_chars(begin(buffer), end(buffer), coord.AsDouble());
+            key.push_back(' ');
+            key.append(buffer, result.ptr);
+        }
+    } else
+    {
+        // Tile x, y of the 2^z by 2^z grid over the whole map.
+        int z = query.at("z").AsInt(), x = query.at("x").AsInt(), y = query.at("y").AsInt();
+        if(z < 0 || z > 30 || x < 0 || y < 0 || x >= (1 << z) || y >= (1 << z))
+            return false;
+        double tileWidth = renderSettings_.width / double(1 << z);
+        double tileHeight = renderSettings_.height / double(1 << z);
+        area = { x * tileWidth, y * tileHeight, (x + 1) * tileWidth, (y + 1) * tileHeight };
+        key = to_string(z) + '/' + to_string(x) + '/' + to_string(y);
+        zoom = z;
+    }
+
+    auto tile = tilePayloads_.find(key);
+    if(tile == tilePayloads_.end())
+    {
+        const auto& index = getMapIndex();
+        const auto* detail = getMapDetail(zoom);
+
+        auto map = makeMapDocument();
+        map.SetViewBox({ area.minX, area.minY }, { area.maxX - area.minX, area.maxY - area.minY });
+        // Lines are cut down to what can be seen of them in the tile.
+        auto clip = area.Expanded(renderSettings_.lineWidth);
+        for(auto item : index.Query(area))
+            renderMapItem(map, item, detail, &clip);
+
+        if(tilePayloads_.size() >= TILE_CACHE_SIZE)
+            tilePayloads_.clear();
+        tile = tilePayloads_.emplace(move(key), RenderPayload(map)).first;
+    }
+
+    arr.Value(MapResponse{ query.at("id").AsInt(), Json::Verbatim(tile->second) });
+
+    return true;
+}
+
+bool TransportManager::performRouteMapQuery(
+            const Json::Dict &query,
+            Json::JsonArray<Json::JsonBase>& arr
+        )
+{
+    auto from = BusStations::getWaitVertex(stations_.at(query.at("from").AsString()));
+    auto to = BusStations::getWaitVertex(stations_.at(query.at("to").AsString()));
+
+    if(!router_)
+        return false;
+
+    auto info = router_->BuildRoute(from, to);
+
+    if(!info.has_value())
+        return false;
+
+    auto base = getMapPayload();
+
+    vector<RouteRide> rides;
     for(size_t i = 0; i < info->edge_count; i++)
-        graph_->GetEdge(router_->GetRouteEdge(info->id, i)).weight.printInJson(stationsArr);
+    {
+        const auto& edge = graph_->GetEdge(router_->GetRouteEdge(info->id, i));
+        if(edge.weight.getType() != PathItem::DRIVE)
+            continue;
+
+        auto ride = makeRouteRide(buses_.at(edge.weight.getName()),
+                                  StationId(edge.from / 2),
+                                  StationId(edge.to / 2),
+                                  edge.weight.getSpanCount());
+        if(!ride.stops.empty())
+            rides.push_back(move(ride));
+    }
+
+    router_->ReleaseRoute(info->id);
 
-    stationsArr.EndArray().EndObject();
+    // The whole base map is dimmed and the route drawn over it, layer by
+    // layer as in the base map.
+    Svg::Document overlay;
+    overlay.Add(Svg::Rect{}.SetOrigin({ 0.0, 0.0 })
+                .SetSize({ renderSettings_.width, renderSettings_.height })
+                .SetFillColor(renderSettings_.underlayerColor)
+                .SetFillOpacity(ROUTE_DIM_OPACITY));
+    for(const auto& range: mapLayers_)
+        (this->*range.layer->renderRoute)(overlay, rides);
+
+    arr.Value(MapResponse{ query.at("id").AsInt(), SvgOverlayString(base, overlay) });
 
     return true;
 }
 
-bool TransportManager::performMapQuery(
-            const std::map<string, Json::Node> &query,
+// New render settings for the map queries that follow. Layers whose style
+// is left as it was are not drawn again.
+bool TransportManager::performRenderSettingsQuery(
+            const Json::Dict &query,
             Json::JsonArray<Json::JsonBase>& arr
         )
 {
-    stringstream svgMap;
-    getMap().Render(svgMap, true);
-    mapString_ = svgMap.str();
-    arr.BeginObject()
-         .Key("request_id").Integer(query.at("id").AsInt())
-         .Key("map").String(mapString_)
-         .EndObject();
+    setRenderSettings(query.at("render_settings").AsMap());
+    arr.Value(SettingsResponse{ query.at("id").AsInt() });
 
     return true;
 }
@@ -428,22 +1522,150 @@ bool TransportManager::performMapQuery(
 template <typename JsonObject>
 void print_error(JsonObject& obj, int req_id, string_view message)
 {
-    obj.BeginObject()
-       .Key("request_id").Integer(req_id)
-       .Key("error_message").String(message)
-       .EndObject();
+    obj.Value(ErrorResponse{ req_id, message });
 }
 
 
-void TransportManager::performQueries(const std::vector<Json::Node>& statRequests, ostream& stream)
+void TransportManager::performQueries(const Json::Array& statRequests, ostream& stream)
 {
-    auto array = Json::PrintJsonArray(stream);
+    Io::StreamSink sink(stream);
+    Io::OutputBuffer out(sink);
+    Json::JsonWriter writer(out);
+
+    performQueries(statRequests, writer);
+    out.Flush();
+}
+
+void TransportManager::performQueries(const Json::Array& statRequests, Json::JsonWriter& writer)
+{
+    auto array = Json::PrintJsonArray(writer);
 
     for(auto& req : statRequests)
     {
         const auto & map = req.AsMap();
-        string type = map.at("type").AsString();
+        string_view type = map.at("type").AsString();
         if(!(this->*performers_.at(type))(map, array))
-            print_error(array, map.at("request_id").AsInt(), "not_found");
+            print_error(array, map.at("id").AsInt(), "not_found");
+    }
+
+    array.EndArray();
+}
+
+void TransportManager::performBinaryQueries(istream& input, ostream& output)
+{
+    string payload;
+    Binary::Writer writer;
+
+    for(auto frame = Binary::ReadFrame(input, payload); frame != Binary::Frame::End;
+        frame = Binary::ReadFrame(input, payload))
+    {
+        // A malformed request only fails itself; the id is 0 if even that
+        // could not be read.
+        uint32_t id = 0;
+        try
+        {
+            Binary::Reader query(payload);
+            auto type = Binary::MessageType(query.U8());
+            id = query.U32();
+
+            auto performer = binaryPerformers_.find(type);
+            if(frame == Binary::Frame::TooLarge || performer == binaryPerformers_.end() ||
+               !(this->*performer->second)(id, query, writer))
+                writer.Begin(Binary::MessageType::Error, id);
+        } catch(const Binary::DecodeError&)
+        {
+            writer.Begin(Binary::MessageType::Error, id);
+        }
+
+        writer.Flush(output);
+    }
+}
+
+bool TransportManager::performBinaryNamesQuery(uint32_t id, Binary::Reader&, Binary::Writer& out)
+{
+    out.Begin(Binary::MessageType::Names, id);
+
+    out.U32(stations_.size());
+    for(StationId station = 0; station < stations_.size(); station++)
+        out.String(stations_.getName(station));
+
+    out.U32(buses_.size());
+    for(BusId bus = 0; bus < buses_.size(); bus++)
+        out.String(buses_.getName(bus));
+
+    return true;
+}
+
+bool TransportManager::performBinaryBusQuery(uint32_t id, Binary::Reader& query, Binary::Writer& out)
+{
+    auto busId = query.U32();
+    if(busId >= buses_.size())
+        return false;
+
+    const auto& stats = buses_.getStats(busId);
+    out.Begin(Binary::MessageType::Bus, id)
+       .F64(stats.routeLength)
+       .F64(stats.curvature)
+       .U32(stats.stopCount)
+       .U32(stats.uniqueStopCount);
+
+    return true;
+}
+
+bool TransportManager::performBinaryStopQuery(uint32_t id, Binary::Reader& query, Binary::Writer& out)
+{
+    auto stationId = query.U32();
+    if(stationId >= stations_.size())
+        return false;
+
+    auto buses = stations_.getBuses(stationId);
+    out.Begin(Binary::MessageType::Stop, id)
+       .U32(buses.size());
+    for(auto bus : buses)
+        out.U32(bus);
+
+    return true;
+}
+
+bool TransportManager::performBinaryRouteQuery(uint32_t id, Binary::Reader& query, Binary::Writer& out)
+{
+    auto fromId = query.U32();
+    auto toId = query.U32();
+    if(!router_ || fromId >= stations_.size() || toId >= stations_.size())
+        return false;
+
+    auto info = router_->BuildRoute(BusStations::getWaitVertex(fromId),
+                                    BusStations::getWaitVertex(toId));
+    if(!info.has_value())
+        return false;
+
+    out.Begin(Binary::MessageType::Route, id)
+       .F64(info->weight.getTime())
+       .U32(info->edge_count);
+
+    for(size_t i = 0; i < info->edge_count; i++)
+    {
+        const auto& item = graph_->GetEdge(router_->GetRouteEdge(info->id, i)).weight;
+        if(item.getType() == PathItem::WAIT)
+            out.U8(uint8_t(Binary::RouteItemType::Wait))
+               .F64(item.getTime())
+               .U32(stations_.at(item.getName()));
+        else
+            out.U8(uint8_t(Binary::RouteItemType::Bus))
+               .F64(item.getTime())
+               .U32(buses_.at(item.getName()))
+               .U32(item.getSpanCount());
     }
+
+    router_->ReleaseRoute(info->id);
+
+    return true;
+}
+
+bool TransportManager::performBinaryMapQuery(uint32_t id, Binary::Reader&, Binary::Writer& out)
+{
+    out.Begin(Binary::MessageType::Map, id)
+       .String(getMapSvg());
+
+    return true;
 }
@@ -3,20 +3,26 @@
 
 #include <unordered_map>
 #include <string_view>
+#include <optional>
 #include <string>
 #include <memory>
 #include <vector>
+#include <map>
 
+#include "binary_protocol.h"
+#include "bus_station.h"
+#include "csv_reader.h"
+#include "bus.h"
 #include "json.h"
 #include "graph.h"
+#include "spatial_index.h"
 #include "svg.h"
 
-class BusStation;
 class PathItem;
-class Bus;
 
 namespace Json {
 
+class JsonWriter;
 class JsonBase;
 
 template <typename T>
@@ -29,15 +35,30 @@ class TransportManager
     using GraphType = Graph::DirectedWeightedGraph<PathItem>;
     using RouterType = Graph::Router<PathItem>;
 
-    std::map<std::string_view, std::shared_ptr<BusStation>> stations_;
-    std::map<std::string_view, std::shared_ptr<Bus>> buses_;
+    BusStations stations_;
+    Buses buses_;
 
     std::unique_ptr<GraphType> graph_;
     std::unique_ptr<RouterType> router_;
 
     std::optional<double> maxLatitude_, minLatitude_, maxLongitude_, minLongitude_, zoomCoef_;
     std::optional<Svg::Document> map_;
-    std::string mapString_;
+    // The map as a quoted and escaped JSON string, shared by all Map queries.
+    std::optional<std::string> mapPayload_;
+    // The map as plain SVG, shared by all binary Map queries.
+    std::optional<std::string> mapSvg_;
+
+    // Bus and Stop responses rendered ahead of time, all in one arena and
+    // indexed by id; at query time only the request id is spliced in between
+    // head and tail.
+    struct ResponseFragment
+    {
+        size_t offset;
+        size_t headSize;
+        size_t tailSize;
+    };
+    std::string responseArena_;
+    std::vector<ResponseFragment> busResponses_, stopResponses_;
 
     struct RoutingSettings
     {
@@ -60,68 +81,253 @@ class TransportManager
         Svg::Point stopLblOffset = { 0.0, 0.0 };
         std::vector<Svg::Color> colorPalette;
         std::vector<std::string> renderOrder;
+        std::optional<double> coordinateScale;
+        std::optional<double> simplifyTolerance;
+        std::optional<double> lodCellSize;
+        bool singlePassLines = false;
+        bool compact = false;
     } renderSettings_;
 
-    std::unordered_map<std::string, void (TransportManager::*)(void)> renderFuncs_ {
-        { "bus_lines", &TransportManager::renderBusLines },
-        { "bus_labels", &TransportManager::renderBusLabels },
-        { "stop_points", &TransportManager::renderStationPoints },
-        { "stop_labels", &TransportManager::renderStationLabels }
+    // One bus ride of a route: the stops passed, boarding and leaving
+    // included, and the position of the bus in mapBuses_.
+    struct RouteRide
+    {
+        BusId bus = 0;
+        size_t pos = 0;
+        std::vector<StationId> stops;
+    };
+
+    // The map with less detail, for networks too dense to draw in full:
+    // stops sharing a grid cell are drawn as the first of them by name, a
+    // label is left out if it would overlap one placed before, bus labels
+    // first, and a stretch of road between two cells is drawn only for the
+    // first bus passing it. Stops are indexed by id, buses by position.
+    struct MapDetail
+    {
+        std::vector<Svg::Point> anchors;
+        std::vector<bool> markers;
+        std::vector<bool> stopLabels;
+        // Two per bus: at the first and at the last stop.
+        std::vector<bool> busLabels;
+        // Lines of bus pos are lines[lineStart[pos] .. lineStart[pos + 1]).
+        std::vector<size_t> lineStart;
+        std::vector<std::vector<Svg::Point>> lines;
+    };
+
+    // Layers are drawn one item at a time, buses and stops in name order, so
+    // any range of items can be rendered on its own and the pieces joined.
+    // Given a clip box, a layer may leave out what falls outside it, as
+    // long as nothing inside it looks any different. The style key covers
+    // every setting the layer's figures depend on except geometry.
+    struct MapLayer
+    {
+        enum Items { BUSES, STOPS } items;
+        void (TransportManager::*render)(Svg::Document&, size_t, const MapDetail*,
+                                         const Spatial::Box*) const;
+        Spatial::Box (TransportManager::*bounds)(size_t) const;
+        void (TransportManager::*renderRoute)(Svg::Document&, const std::vector<RouteRide>&) const;
+        std::string (TransportManager::*styleKey)() const;
+    };
+    std::unordered_map<std::string, MapLayer> renderFuncs_ {
+        { "bus_lines", { MapLayer::BUSES, &TransportManager::renderBusLine,
+                         &TransportManager::busLineBounds,
+                         &TransportManager::renderRouteBusLines,
+                         &TransportManager::busLineStyle } },
+        { "bus_labels", { MapLayer::BUSES, &TransportManager::renderBusLabels,
+                          &TransportManager::busLabelsBounds,
+                          &TransportManager::renderRouteBusLabels,
+                          &TransportManager::busLabelsStyle } },
+        { "stop_points", { MapLayer::STOPS, &TransportManager::renderStationPoint,
+                           &TransportManager::stationPointBounds,
+                           &TransportManager::renderRouteStationPoints,
+                           &TransportManager::stationPointStyle } },
+        { "stop_labels", { MapLayer::STOPS, &TransportManager::renderStationLabels,
+                           &TransportManager::stationLabelsBounds,
+                           &TransportManager::renderRouteStationLabels,
+                           &TransportManager::stationLabelsStyle } }
     };
+    std::vector<BusId> mapBuses_;
+    std::vector<StationId> mapStations_;
+
+    // Stops projected onto the map by id; bus lines are read off the same
+    // table. Kept until the network or the map geometry changes.
+    std::vector<Svg::Point> stationPoints_;
 
-    std::unordered_map<std::string, bool (TransportManager::*)(
-                                        const std::map<std::string,Json::Node>&,
+    // Every layer drawn so far, as figures and as escaped JSON, with the
+    // style key it was drawn with. A layer is drawn again only once its key
+    // changes; a new layer order just joins the fragments differently.
+    struct MapFragment
+    {
+        std::string styleKey;
+        Svg::Document figures;
+        std::string payload;
+    };
+    std::unordered_map<const MapLayer*, MapFragment> mapFragments_;
+
+    // Less detailed maps by tile zoom, the whole map being zoom 0.
+    std::unordered_map<int, MapDetail> mapDetails_;
+
+    // Items of all layers numbered in drawing order: layer items
+    // [begin, end) are the buses or stops of that layer.
+    struct MapLayerRange
+    {
+        size_t begin, end;
+        const MapLayer* layer;
+    };
+    std::vector<MapLayerRange> mapLayers_;
+    size_t mapItemCount_ = 0;
+
+    // Boxes of all map items, for MapTile queries, and the tiles served so
+    // far as escaped JSON strings, keyed by the requested area.
+    static const size_t TILE_CACHE_SIZE = 256;
+    std::optional<Spatial::GridIndex> mapIndex_;
+    std::unordered_map<std::string, std::string> tilePayloads_;
+
+    std::unordered_map<std::string_view, bool (TransportManager::*)(
+                                        const Json::Dict&,
                                         Json::JsonArray<Json::JsonBase>&
                                     )> performers_ = {
         { "Bus", &TransportManager::performBusQuery },
         { "Stop", &TransportManager::performStopQuery },
         { "Route", &TransportManager::performRouteQuery },
-        { "Map", &TransportManager::performMapQuery }
+        { "Map", &TransportManager::performMapQuery },
+        { "MapTile", &TransportManager::performMapTileQuery },
+        { "RouteMap", &TransportManager::performRouteMapQuery },
+        { "RenderSettings", &TransportManager::performRenderSettingsQuery }
+    };
+
+    std::unordered_map<Binary::MessageType, bool (TransportManager::*)(
+                                        uint32_t,
+                                        Binary::Reader&,
+                                        Binary::Writer&
+                                    )> binaryPerformers_ = {
+        { Binary::MessageType::Names, &TransportManager::performBinaryNamesQuery },
+        { Binary::MessageType::Bus, &TransportManager::performBinaryBusQuery },
+        { Binary::MessageType::Stop, &TransportManager::performBinaryStopQuery },
+        { Binary::MessageType::Route, &TransportManager::performBinaryRouteQuery },
+        { Binary::MessageType::Map, &TransportManager::performBinaryMapQuery }
     };
 
 public:
-    void performQueries(const std::vector<Json::Node> &statRequests, std::ostream &stream);
-    void addBus(std::string name, std::vector<Json::Node> stations, bool isLooped);
+    void performQueries(const Json::Array &statRequests, std::ostream &stream);
+    void performQueries(const Json::Array &statRequests, Json::JsonWriter &writer);
+    void performBinaryQueries(std::istream& input, std::ostream& output);
+    void addBus(std::string name, const Json::Array& stations, bool isLooped);
 
-    TransportManager& setRoutingSettings(const std::map<std::string, Json::Node>& routingSettings);
-    TransportManager& setRenderSettings(const std::map<std::string, Json::Node>& renderSettings);
+    TransportManager& setRoutingSettings(const Json::Dict& routingSettings);
+    TransportManager& setRenderSettings(const Json::Dict& renderSettings);
+    // Dropped again by addBus(); call it once the network is complete.
+    TransportManager& precomputeResponses(std::optional<int> precision = std::nullopt);
 
-    static TransportManager& createInstance(const std::vector<Json::Node> &base_requests);
+    static TransportManager& createInstance(const Json::Array &base_requests);
+    static TransportManager& createInstance(Csv::Feed& feed);
 
 private:
-    TransportManager(const std::vector<Json::Node> &base_requests);
+    TransportManager(const Json::Array &base_requests);
+    TransportManager(Csv::Feed& feed);
     void updateRouter();
 
-    void addStation(std::string name, double latitude, double longitude,
-                    const std::map<std::string, Json::Node> &distances);
+    std::vector<StationId> resolveStops(const Json::Array& stations) const;
+
+    std::pair<StationId, bool> addStation(std::string_view name, double latitude, double longitude);
+    void addBus(std::string name, const std::vector<StationId>& stops, bool isLooped);
+
+    bool spliceResponse(const std::vector<ResponseFragment>& responses,
+                        std::optional<uint32_t> id,
+                        const Json::Dict& query,
+                        Json::JsonArray<Json::JsonBase>& arr) const;
 
     void updateZoomCoef();
     const Svg::Document& getMap();
+    std::string_view getMapPayload();
+    std::string_view getMapSvg();
+    const Spatial::GridIndex& getMapIndex();
+    void invalidateMap();
+    void invalidateMapOutput();
+    void invalidateResponses();
+    void prepareMapItems();
+    void updateMapFragments();
+    const MapDetail* getMapDetail(int zoom);
+    MapDetail makeMapDetail(double cellSize) const;
+    Svg::Document makeMapDocument() const;
+    void renderMapItem(Svg::Document& map, size_t item, const MapDetail* detail,
+                       const Spatial::Box* clip) const;
     Svg::Point createPoint(double latitude, double longitude) const;
+    Svg::Point stationPoint(StationId station) const;
 
     //render_performers
-    void renderBusLines();
-    void renderBusLabels();
-    void renderStationPoints();
-    void renderStationLabels();
+    Svg::Polyline makeBusLine(size_t pos, const std::vector<Svg::Point>& points,
+                              const Spatial::Box* clip) const;
+    // In compact mode a label gets an id from its bus or stop, which the
+    // route overlay prefixes to keep it apart from the map below.
+    void addBusLabel(Svg::Document& map, BusId bus, Svg::Point point, size_t pos, bool last,
+                     std::string_view idPrefix = {}) const;
+    void addStationPoint(Svg::Document& map, StationId station) const;
+    void addStationLabel(Svg::Document& map, StationId station, std::string_view idPrefix = {}) const;
+    bool isTerminal(BusId bus, StationId station) const;
+
+    void renderBusLine(Svg::Document& map, size_t pos, const MapDetail* detail,
+                       const Spatial::Box* clip) const;
+    void renderBusLabels(Svg::Document& map, size_t pos, const MapDetail* detail,
+                         const Spatial::Box* clip) const;
+    void renderStationPoint(Svg::Document& map, size_t pos, const MapDetail* detail,
+                            const Spatial::Box* clip) const;
+    void renderStationLabels(Svg::Document& map, size_t pos, const MapDetail* detail,
+                             const Spatial::Box* clip) const;
+
+    Spatial::Box busLineBounds(size_t pos) const;
+    Spatial::Box busLabelsBounds(size_t pos) const;
+    Spatial::Box stationPointBounds(size_t pos) const;
+    Spatial::Box stationLabelsBounds(size_t pos) const;
+
+    std::string busLineStyle() const;
+    std::string busLabelsStyle() const;
+    std::string stationPointStyle() const;
+    std::string stationLabelsStyle() const;
+    std::string detailStyle() const;
+
+    RouteRide makeRouteRide(BusId bus, StationId from, StationId to, size_t spanCount) const;
+    void renderRouteBusLines(Svg::Document& map, const std::vector<RouteRide>& rides) const;
+    void renderRouteBusLabels(Svg::Document& map, const std::vector<RouteRide>& rides) const;
+    void renderRouteStationPoints(Svg::Document& map, const std::vector<RouteRide>& rides) const;
+    void renderRouteStationLabels(Svg::Document& map, const std::vector<RouteRide>& rides) const;
 
     //query_performers
     bool performStopQuery(
-                const std::map<std::string, Json::Node>& query,
+                const Json::Dict& query,
                 Json::JsonArray<Json::JsonBase>& arr
             );
     bool performBusQuery(
-                const std::map<std::string, Json::Node>& query,
+                const Json::Dict& query,
                 Json::JsonArray<Json::JsonBase>& arr
             );
     bool performRouteQuery(
-                const std::map<std::string, Json::Node>& query,
+                const Json::Dict& query,
                 Json::JsonArray<Json::JsonBase>& arr
             );
     bool performMapQuery(
-                const std::map<std::string, Json::Node>& query,
+                const Json::Dict& query,
+                Json::JsonArray<Json::JsonBase>& arr
+            );
+    bool performMapTileQuery(
+                const Json::Dict& query,
+                Json::JsonArray<Json::JsonBase>& arr
+            );
+    bool performRouteMapQuery(
+                const Json::Dict& query,
+                Json::JsonArray<Json::JsonBase>& arr
+            );
+    bool performRenderSettingsQuery(
+                const Json::Dict& query,
                 Json::JsonArray<Json::JsonBase>& arr
             );
+
+    //binary_query_performers
+    bool performBinaryNamesQuery(uint32_t id, Binary::Reader& query, Binary::Writer& out);
+    bool performBinaryBusQuery(uint32_t id, Binary::Reader& query, Binary::Writer& out);
+    bool performBinaryStopQuery(uint32_t id, Binary::Reader& query, Binary::Writer& out);
+    bool performBinaryRouteQuery(uint32_t id, Binary::Reader& query, Binary::Writer& out);
+    bool performBinaryMapQuery(uint32_t id, Binary::Reader& query, Binary::Writer& out);
 };
 
 #endif // TRANSPORTMANAGER_H